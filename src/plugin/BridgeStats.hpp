@@ -0,0 +1,117 @@
+// SPDX-FileCopyrightText: 2023-2024 MOD Audio UG
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#pragma once
+
+#include "DistrhoUtils.hpp"
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+// Aggregates shm bridge timings over a window of processed audio time, regardless of how many cycles it takes.
+// Meant to be fed and read from the audio thread only, so it needs no locking nor atomics.
+
+class BridgeStats
+{
+public:
+    // histogram for the time spent waiting on the server side, 20us resolution up to 20ms
+    static constexpr const uint32_t kNumBuckets = 1000;
+    static constexpr const uint32_t kBucketSizeNs = 20000;
+
+    struct Summary {
+        float waitMin;
+        float waitAvg;
+        float waitMax;
+        float waitP99;
+        float dspLoad;
+    };
+
+    BridgeStats() noexcept
+    {
+        reset();
+    }
+
+    // set the amount of processed audio, in nanoseconds, to aggregate before publishing a new summary
+    void setWindowTime(const uint64_t time) noexcept
+    {
+        windowTime = std::max<uint64_t>(1, time);
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        std::memset(buckets, 0, sizeof(buckets));
+        numCycles = numLoadCycles = 0;
+        elapsedTime = 0;
+        waitMin = UINT64_MAX;
+        waitMax = waitSum = 0;
+        loadSum = 0.0;
+    }
+
+    // add one processing cycle, wait time and duration of the processed audio in nanoseconds,
+    // plus server load as ratio of the available time.
+    // a negative load means the server side did not report timings.
+    // returns true when a new summary is available.
+    bool addCycle(const uint64_t waitTime, const uint64_t cycleTime, const double load) noexcept
+    {
+        waitMin = std::min(waitMin, waitTime);
+        waitMax = std::max(waitMax, waitTime);
+        waitSum += waitTime;
+        ++buckets[std::min<uint64_t>(kNumBuckets - 1, waitTime / kBucketSizeNs)];
+
+        if (load >= 0.0)
+        {
+            loadSum += load;
+            ++numLoadCycles;
+        }
+
+        ++numCycles;
+        elapsedTime += cycleTime;
+
+        if (elapsedTime < windowTime)
+            return false;
+
+        // find the bucket containing the 99th percentile, reporting its upper edge
+        const uint32_t p99count = numCycles - numCycles / 100;
+        uint32_t count = 0, bucket = 0;
+        for (; bucket < kNumBuckets - 1; ++bucket)
+        {
+            count += buckets[bucket];
+            if (count >= p99count)
+                break;
+        }
+
+        summary.waitMin = waitMin * 0.000001f;
+        summary.waitAvg = static_cast<double>(waitSum) / numCycles * 0.000001;
+        summary.waitMax = waitMax * 0.000001f;
+        summary.waitP99 = std::min(waitMax, static_cast<uint64_t>(bucket + 1) * kBucketSizeNs) * 0.000001f;
+        summary.dspLoad = numLoadCycles != 0 ? loadSum / numLoadCycles * 100.0 : 0.f;
+
+        reset();
+        return true;
+    }
+
+    // last published summary, times in milliseconds and load in percent
+    const Summary& getSummary() const noexcept
+    {
+        return summary;
+    }
+
+private:
+    uint32_t buckets[kNumBuckets];
+    uint64_t windowTime = 1;
+    uint64_t elapsedTime;
+    uint32_t numCycles;
+    uint32_t numLoadCycles;
+    uint64_t waitMin;
+    uint64_t waitMax;
+    uint64_t waitSum;
+    double loadSum;
+    Summary summary = {};
+
+    DISTRHO_DECLARE_NON_COPYABLE(BridgeStats)
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -12,14 +12,26 @@
 # include <windows.h>
 #else
 # include <cerrno>
+# include <cstdio>
 # include <ctime>
+# include <fcntl.h>
+# include <poll.h>
 # include <signal.h>
+# include <unistd.h>
 # include <sys/wait.h>
+# ifdef DISTRHO_OS_LINUX
+#  include <syscall.h>
+# endif
 #endif
 
 START_NAMESPACE_DISTRHO
 
 // -----------------------------------------------------------------------------------------------------------
+// Child process supervision, waiting on process exit events instead of polling where possible.
+// On Linux a pidfd is kept for each child, which becomes readable as soon as the process exits.
+// Windows process handles are waitable as well, other systems fall back to polling.
+// On POSIX systems children can also signal readiness through a notify pipe, whose fd number is passed as
+// MOD_DESKTOP_NOTIFY_FD. There is no such pipe on Windows, callers find out about readiness by other means there.
 
 class ChildProcess
 {
@@ -27,6 +39,8 @@ class ChildProcess
     PROCESS_INFORMATION pinfo = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, 0, 0 };
    #else
     pid_t pid = -1;
+    int pidfd = -1;
+    int notifyfd = -1;
    #endif
 
 public:
@@ -42,7 +56,8 @@ public:
    #ifdef _WIN32
     bool start(const char* const args[], const WCHAR* const envp)
    #else
-    bool start(const char* const args[], char* const* const envp = nullptr)
+    // withNotify sets up a notify pipe for takeNotifyFd(), only possible with an explicit envp
+    bool start(const char* const args[], char* const* const envp = nullptr, const bool withNotify = false)
    #endif
     {
        #ifdef _WIN32
@@ -85,36 +100,61 @@ public:
                               &si,        // lpStartupInfo
                               &pinfo) != FALSE;
        #else
-        const pid_t ret = pid = vfork();
+        int notifyPipe[2] = { -1, -1 };
+        char notifyEnv[32] = {};
+        char** notifyEnvp = nullptr;
 
-        switch (ret)
+        // both sides are close-on-exec, so other children started at the same time do not inherit them
+        // spawn() clears the flag of the write side for this child only
+        if (withNotify && envp != nullptr && createPipe(notifyPipe))
         {
-        // child process
-        case 0:
-            if (envp != nullptr)
-                execve(args[0], const_cast<char* const*>(args), envp);
-            else
-                execvp(args[0], const_cast<char* const*>(args));
+            fcntl(notifyPipe[0], F_SETFL, O_NONBLOCK);
+            std::snprintf(notifyEnv, sizeof(notifyEnv) - 1, "MOD_DESKTOP_NOTIFY_FD=%d", notifyPipe[1]);
 
-            d_stderr2("exec failed: %d:%s", errno, std::strerror(errno));
-            _exit(1);
-            break;
+            uint numEnv = 0;
+            while (envp[numEnv] != nullptr)
+                ++numEnv;
 
-        // error
-        case -1:
-            d_stderr2("vfork() failed: %d:%s", errno, std::strerror(errno));
-            break;
+            notifyEnvp = new char*[numEnv + 2];
+            std::memcpy(notifyEnvp, envp, sizeof(char*) * numEnv);
+            notifyEnvp[numEnv] = notifyEnv;
+            notifyEnvp[numEnv + 1] = nullptr;
+        }
+
+        const pid_t ret = pid = spawn(args, notifyEnvp != nullptr ? notifyEnvp : envp, notifyPipe[1]);
+
+       #ifdef SYS_pidfd_open
+        if (ret > 0)
+            pidfd = static_cast<int>(syscall(SYS_pidfd_open, ret, 0));
+       #endif
+
+        delete[] notifyEnvp;
+
+        if (notifyPipe[1] >= 0)
+        {
+            // the read side sees EOF once the child closes its copy, or exits
+            close(notifyPipe[1]);
+
+            if (ret > 0)
+                notifyfd = notifyPipe[0];
+            else
+                close(notifyPipe[0]);
         }
 
         return ret > 0;
        #endif
     }
 
+    // terminate the process and wait for it to exit, see terminate() and wait() for stopping many in parallel
     void stop(const uint32_t timeoutInMilliseconds = 2000)
     {
-        const uint32_t timeout = d_gettime_ms() + timeoutInMilliseconds;
-        bool sendTerminate = true;
+        terminate();
+        wait(timeoutInMilliseconds);
+    }
 
+    // wait for the process to exit after terminate(), killing it if it takes longer than the timeout
+    void wait(const uint32_t timeoutInMilliseconds = 2000)
+    {
        #ifdef _WIN32
         if (pinfo.hProcess == INVALID_HANDLE_VALUE)
             return;
@@ -122,39 +162,25 @@ public:
         const PROCESS_INFORMATION opinfo = pinfo;
         pinfo = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, 0, 0 };
 
-        for (DWORD exitCode;;)
+        if (WaitForSingleObject(opinfo.hProcess, timeoutInMilliseconds) == WAIT_TIMEOUT)
         {
-            if (GetExitCodeProcess(opinfo.hProcess, &exitCode) == FALSE ||
-                exitCode != STILL_ACTIVE ||
-                WaitForSingleObject(opinfo.hProcess, 0) != WAIT_TIMEOUT)
-            {
-                CloseHandle(opinfo.hThread);
-                CloseHandle(opinfo.hProcess);
-                return;
-            }
-
-            if (sendTerminate)
-            {
-                sendTerminate = false;
-                TerminateProcess(opinfo.hProcess, ERROR_BROKEN_PIPE);
-            }
-
-            if (d_gettime_ms() < timeout)
-            {
-                d_msleep(5);
-                continue;
-            }
-            d_stderr("ChildProcess::stop() - timed out");
+            d_stderr("ChildProcess::wait() - timed out");
             TerminateProcess(opinfo.hProcess, 9);
-            d_msleep(5);
-            CloseHandle(opinfo.hThread);
-            CloseHandle(opinfo.hProcess);
-            break;
+            WaitForSingleObject(opinfo.hProcess, 5);
         }
+
+        CloseHandle(opinfo.hThread);
+        CloseHandle(opinfo.hProcess);
        #else
+        closeNotifyfd();
+
         if (pid <= 0)
+        {
+            closePidfd();
             return;
+        }
 
+        const uint32_t timeout = d_gettime_ms() + timeoutInMilliseconds;
         const pid_t opid = pid;
         pid = -1;
 
@@ -164,53 +190,49 @@ public:
                 ret = ::waitpid(opid, nullptr, WNOHANG);
             } DISTRHO_SAFE_EXCEPTION_BREAK("waitpid");
 
-            switch (ret)
+            if (ret == opid)
+            {
+                // success
+                break;
+            }
+
+            if (ret == -1)
+            {
+                // child doesn't exist is also a success
+                if (errno != ECHILD)
+                    d_stderr("ChildProcess::wait() - waitpid failed: %d:%s", errno, std::strerror(errno));
+                break;
+            }
+
+            if (ret != 0)
             {
-            case -1:
-                if (errno == ECHILD)
-                {
-                    // success, child doesn't exist
-                    return;
-                }
-                else
-                {
-                    d_stderr("ChildProcess::stop() - waitpid failed: %d:%s", errno, std::strerror(errno));
-                    return;
-                }
+                d_stderr("ChildProcess::wait() - got wrong pid %i (requested was %i)", int(ret), int(opid));
                 break;
+            }
+
+            const uint32_t now = d_gettime_ms();
 
-            case 0:
-                if (sendTerminate)
-                {
-                    sendTerminate = false;
-                    kill(opid, SIGTERM);
-                }
-                if (d_gettime_ms() < timeout)
-                {
-                    d_msleep(5);
-                    continue;
-                }
-
-                d_stderr("ChildProcess::stop() - timed out");
+            if (now >= timeout)
+            {
+                d_stderr("ChildProcess::wait() - timed out");
                 kill(opid, SIGKILL);
                 waitpid(opid, nullptr, WNOHANG);
                 break;
-
-            default:
-                if (ret == opid)
-                {
-                    // success
-                    return;
-                }
-                else
-                {
-                    d_stderr("ChildProcess::stop() - got wrong pid %i (requested was %i)", int(ret), int(opid));
-                    return;
-                }
             }
 
-            break;
+            // wake up right when the process exits, instead of polling for it
+            if (pidfd >= 0)
+            {
+                pollfd pfd = { pidfd, POLLIN, 0 };
+                poll(&pfd, 1, static_cast<int>(timeout - now));
+            }
+            else
+            {
+                d_msleep(5);
+            }
         }
+
+        closePidfd();
        #endif
     }
 
@@ -237,10 +259,20 @@ public:
         if (pid <= 0)
             return false;
 
+        // process has not exited as long as its pidfd is not readable, no need to try reaping it
+        if (pidfd >= 0)
+        {
+            pollfd pfd = { pidfd, POLLIN, 0 };
+            if (poll(&pfd, 1, 0) == 0)
+                return true;
+        }
+
         const pid_t ret = ::waitpid(pid, nullptr, WNOHANG);
 
         if (ret == pid || (ret == -1 && errno == ECHILD))
         {
+            closePidfd();
+            closeNotifyfd();
             pid = 0;
             return false;
         }
@@ -249,6 +281,83 @@ public:
        #endif
     }
 
+   #ifndef _WIN32
+    // file descriptor that becomes readable once the process exits, for use in poll(), or -1 if not supported
+    // NOTE closed once the process is reaped, duplicate it to keep watching from elsewhere, see SharedMemory::setPeer()
+    int getExitFd() const noexcept
+    {
+        return pidfd;
+    }
+   #endif
+
+   #ifndef _WIN32
+    // hand over the notify pipe of a starting child, see start(), or -1 if there is none
+    // the caller waits on it through waitForNotify() and closes it when done, without needing any lock around us
+    int takeNotifyFd() noexcept
+    {
+        const int fd = notifyfd;
+        notifyfd = -1;
+        return fd;
+    }
+
+    // wait for the child to write anything to its notify pipe
+    // returns false on timeout, or right away if the child closed the pipe without writing to it (closed is set then)
+    static bool waitForNotify(const int fd, const uint32_t timeoutInMilliseconds, bool& closed)
+    {
+        closed = false;
+
+        pollfd pfd = { fd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, static_cast<int>(timeoutInMilliseconds)) <= 0)
+            return false;
+
+        char buf[32];
+        const ssize_t r = read(fd, buf, sizeof(buf));
+
+        if (r > 0)
+            return true;
+
+        // EOF, child will never notify
+        closed = r == 0;
+        return false;
+    }
+   #endif
+
+   #ifdef _WIN32
+    HANDLE getProcessHandle() const noexcept
+    {
+        return pinfo.hProcess;
+    }
+   #else
+    pid_t getPid() const noexcept
+    {
+        return pid;
+    }
+   #endif
+
+    // freeze the process without terminating it, see resume()
+    void suspend()
+    {
+       #ifdef _WIN32
+        if (pinfo.hProcess != INVALID_HANDLE_VALUE)
+            if (const NtProcessFunc func = getNtProcessFunc("NtSuspendProcess"))
+                func(pinfo.hProcess);
+       #else
+        signal(SIGSTOP);
+       #endif
+    }
+
+    void resume()
+    {
+       #ifdef _WIN32
+        if (pinfo.hProcess != INVALID_HANDLE_VALUE)
+            if (const NtProcessFunc func = getNtProcessFunc("NtResumeProcess"))
+                func(pinfo.hProcess);
+       #else
+        signal(SIGCONT);
+       #endif
+    }
+
    #ifndef _WIN32
     void signal(const int sig)
     {
@@ -257,17 +366,104 @@ public:
     }
    #endif
 
+    // ask the process to exit, without waiting for it
     void terminate()
     {
        #ifdef _WIN32
         if (pinfo.hProcess != INVALID_HANDLE_VALUE)
-            TerminateProcess(pinfo.hProcess, 15);
+            TerminateProcess(pinfo.hProcess, ERROR_BROKEN_PIPE);
        #else
         if (pid > 0)
+        {
             kill(pid, SIGTERM);
+            // a suspended process only handles the signal once continued
+            kill(pid, SIGCONT);
+        }
        #endif
     }
 
+private:
+   #ifndef _WIN32
+    // start a new process, returning its pid or -1 on failure
+    // inheritFd is a close-on-exec fd to be kept open in the new process, if any
+    static pid_t spawn(const char* const args[], char* const* const envp, const int inheritFd = -1)
+    {
+        const pid_t ret = vfork();
+
+        switch (ret)
+        {
+        // child process
+        case 0:
+            if (inheritFd >= 0)
+                fcntl(inheritFd, F_SETFD, 0);
+
+            if (envp != nullptr)
+                execve(args[0], const_cast<char* const*>(args), envp);
+            else
+                execvp(args[0], const_cast<char* const*>(args));
+
+            d_stderr2("exec failed: %d:%s", errno, std::strerror(errno));
+            _exit(1);
+            break;
+
+        // error
+        case -1:
+            d_stderr2("vfork() failed: %d:%s", errno, std::strerror(errno));
+            break;
+        }
+
+        return ret;
+    }
+   #endif
+
+   #ifndef _WIN32
+    // NOTE macOS has no pipe2, a child started from another thread in between can still inherit this pipe there
+    static bool createPipe(int fds[2])
+    {
+       #ifdef DISTRHO_OS_LINUX
+        return pipe2(fds, O_CLOEXEC) == 0;
+       #else
+        if (pipe(fds) != 0)
+            return false;
+
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        return true;
+       #endif
+    }
+
+    void closePidfd()
+    {
+        if (pidfd >= 0)
+        {
+            close(pidfd);
+            pidfd = -1;
+        }
+    }
+
+    void closeNotifyfd()
+    {
+        if (notifyfd >= 0)
+        {
+            close(notifyfd);
+            notifyfd = -1;
+        }
+    }
+   #endif
+
+   #ifdef _WIN32
+    // undocumented but long-standing ntdll calls, there is no public API to suspend a whole process
+    typedef LONG (NTAPI* NtProcessFunc)(HANDLE);
+
+    static NtProcessFunc getNtProcessFunc(const char* const name)
+    {
+        if (const HMODULE ntdll = GetModuleHandleA("ntdll.dll"))
+            return reinterpret_cast<NtProcessFunc>(GetProcAddress(ntdll, name));
+
+        return nullptr;
+    }
+   #endif
+
     DISTRHO_DECLARE_NON_COPYABLE(ChildProcess)
 };
 
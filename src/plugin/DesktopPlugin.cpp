@@ -4,8 +4,10 @@
 #include "DistrhoPlugin.hpp"
 
 #include "AudioRingBuffer.hpp"
-#include "ChildProcess.hpp"
+#include "BridgeStats.hpp"
+#include "Engine.hpp"
 #include "SharedMemory.hpp"
+#include "StartupProfiler.hpp"
 #include "extra/RingBuffer.hpp"
 #include "extra/Runner.hpp"
 #include "extra/ScopedPointer.hpp"
@@ -22,41 +24,84 @@ class DesktopPlugin : public Plugin,
                       public Runner
 {
     static constexpr const uint kMaxMidiSize = 512 * 4;
-
-    ChildProcess jackd;
-    ChildProcess mod_ui;
+    static constexpr const uint kMaxPipelineDepth = 4;
+    static constexpr const uint kMaxEngineKeepAlive = 600;
+    static constexpr const uint kMaxHibernateDelay = 3600;
+    static constexpr const uint kDefaultResamplerQuality = 32;
+    static constexpr const uint32_t kModUIStartupTimeout = 30000;
+    static constexpr const uint32_t kModUIStartupPollInterval = 20;
+
+    enum ModUIMode {
+        // started together with the engine, loads the saved pedalboard
+        kModUIAlways,
+        // experimental, started once the plugin UI is opened, the engine stays silent until then
+        // mod-ui is what loads a saved pedalboard, so with one it is started right away like in kModUIAlways
+        kModUIOnDemand
+    };
+
+    Engine* engine = nullptr;
+    uint engineClient = 0;
+    bool sharedEngine = false;
+    bool sharedEngineRequest = false;
+    uint engineKeepAlive = 10;
+    uint engineSampleRate = 48000;
+    bool nativeSampleRateRequest = false;
+    bool nativeSampleRateSupported = true;
+    uint32_t unsupportedSampleRate = 0;
+    bool inProcessEngine = false;
+    bool inProcessEngineRequest = false;
     SharedMemory shm;
     String currentPedalboard;
-    bool startingJackd = false;
-    bool startingModUI = false;
+    std::atomic<bool> hasSavedPedalboard { false };
+    ModUIMode modUIMode = kModUIAlways;
+    std::atomic<bool> modUIRequested { false };
     std::atomic<bool> processing { false };
+    // host side activation, dedicated engines are frozen after being inactive for a while
+    std::atomic<bool> active { false };
+    std::atomic<uint32_t> deactivatedTime { 0 };
+    uint hibernateDelay = 0;
+    // set by the Runner after (re)syncing the bridge, audio thread starts over with empty buffers and new latency
+    std::atomic<bool> bridgeChanged { false };
+    bool resyncing = false;
     bool shouldStartRunner = true;
+    // set after adopting a parked engine, its old graph is cleared by the Runner thread
+    bool adoptedGraphPending = false;
     float parameters[kParameterCount] = {};
-    float* tempBuffers[2] = {};
+    float* tempBuffers[SharedMemory::kMaxChannels] = {};
     uint numSamplesInTempBuffers = 0;
     uint numSamplesUntilProcessing = 0;
+    uint pipelineDepth = 0;
+    uint pipelineDepthActive = 0;
+    uint periodSize = SharedMemory::kDefaultPeriodSize;
+    uint periodSizeRequest = SharedMemory::kDefaultPeriodSize;
+    uint numChannels = SharedMemory::kDefaultChannels;
+    uint numChannelsRequest = SharedMemory::kDefaultChannels;
+    bool periodSizeSupported = true;
+    SharedMemory::WaitPolicy waitPolicy = SharedMemory::kWaitPolicySleep;
     int portBaseNum = 0;
 
     AudioRingBuffer audioBufferIn;
     AudioRingBuffer audioBufferOut;
+    BridgeStats bridgeStats;
+    StartupProfiler startupProfiler;
+    bool startupReported = false;
+    SharedMemory::Period discardPeriod;
+    // set up from the host thread and from the Runner after an engine restart, see setupResampler()
+    Mutex resamplerMutex;
     ScopedPointer<Resampler> resamplerTo48kHz;
     ScopedPointer<Resampler> resamplerFrom48kHz;
     double resamplerRatio = 1.0;
+    // filter half-length of the resamplers, higher values cost more CPU and latency for a flatter passband
+    uint resamplerQuality = kDefaultResamplerQuality;
+    uint resamplerQualityRequest = kDefaultResamplerQuality;
 
     double midiFrameOffset = 0.0;
     uint8_t* midiRecvBuffer = nullptr;
     HeapRingBuffer midiRingBuffer;
 
-   #ifdef DISTRHO_OS_WINDOWS
-    const WCHAR* envp;
-   #else
-    char* const* envp;
-   #endif
-
 public:
     DesktopPlugin()
-        : Plugin(kParameterCount, 0, 1),
-          envp(nullptr)
+        : Plugin(kParameterCount, 0, kStateCount)
     {
         if (isDummyInstance())
         {
@@ -64,41 +109,18 @@ public:
             return;
         }
 
-        int availablePortNum = 0;
-        for (int i = 1; i < 999; ++i)
-        {
-            if (shm.canInit(i))
-            {
-                availablePortNum = i;
-                break;
-            }
-        }
-
-        if (availablePortNum == 0)
-        {
-            d_stderr("MOD Desktop: Failed to find available ports");
-            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorShmSetupFailed;
+        if (! attachEngine())
             return;
-        }
 
-        envp = getEvironment(availablePortNum);
+        startupProfiler.mark(StartupProfiler::kPhaseEnvironment);
 
-        if (envp == nullptr)
+        // filter tables are the same for all instances and processes, no need to compute them every time
+        if (const char* const cacheDir = getCacheDir())
         {
-            d_stderr("MOD Desktop: Failed to init environment");
-            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorAppDirNotFound;
-            return;
+            const String resamplerCacheDir(String(cacheDir) + DISTRHO_OS_SEP_STR "resampler-" VERSION);
+            Resampler_table::set_cache_dir(resamplerCacheDir);
         }
 
-        if (! shm.init(availablePortNum))
-        {
-            d_stderr("MOD Desktop: Failed to init shared memory");
-            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorShmSetupFailed;
-            return;
-        }
-
-        portBaseNum = availablePortNum;
-
         setupResampler(getSampleRate());
 
         d_stderr("MOD Desktop: Initial init ok");
@@ -106,30 +128,16 @@ public:
 
     ~DesktopPlugin()
     {
-        stopRunner();
+        // a dedicated engine can be parked for the next instance, it gets stopped on deletion otherwise
+        stopEngine(true);
 
-        if (processing && jackd.isRunning())
-        {
-            processing = false;
-            shm.stopWait();
-        }
+        // instances removed before finishing startup are reported too, as they can point to a stuck phase
+        if (startupProfiler.hasReached(StartupProfiler::kPhaseActivate))
+            reportStartup(false);
 
-        jackd.stop();
-        mod_ui.stop();
-        shm.deinit();
+        detachEngine(engineKeepAlive * 1000);
 
-        delete[] tempBuffers[0];
-        delete[] tempBuffers[1];
-
-        if (envp != nullptr)
-        {
-           #ifndef DISTRHO_OS_WINDOWS
-            for (uint i = 0; envp[i] != nullptr; ++i)
-                std::free(envp[i]);
-           #endif
-
-            delete[] envp;
-        }
+        deleteTempBuffers();
     }
 
 protected:
@@ -138,110 +146,285 @@ protected:
 
     bool run() override
     {
-       #ifdef DISTRHO_OS_WINDOWS
-        #define APP_EXT ".exe"
-       #else
-        #define APP_EXT ""
-       #endif
+        if (! sharedEngine && hibernateDelay != 0)
+        {
+            const MutexLocker cml(engine->getLock());
 
-        if (shm.data == nullptr && ! shm.init(portBaseNum))
+            // checked again with the lock held, so activate() always gets to wake up the engine
+            if (! active && d_gettime_ms() - deactivatedTime >= hibernateDelay * 1000)
+                engine->hibernate();
+
+            if (engine->isHibernating())
+                return true;
+        }
+
+        if (shm.data == nullptr && ! shm.init(portBaseNum, engineClient))
         {
             d_stderr("MOD Desktop: Failed to init shared memory inside runner");
             parameters[kParameterBasePortNumber] = portBaseNum = -kErrorShmSetupFailed;
             return false;
         }
 
-        if (! jackd.isRunning())
+        // clearing the graph can take seconds, so it is not done while activating nor with the engine lock held
+        if (adoptedGraphPending)
+        {
+            if (! isRunnerActive())
+                return true;
+
+            adoptedGraphPending = false;
+            engine->clearGraph();
+        }
+
+        bool jackdStarting = false;
+
         {
-            if (startingJackd)
+            const MutexLocker cml(engine->getLock());
+
+            switch (engine->runJackd())
             {
-                d_stderr("MOD Desktop: Failed to get jackd to run");
-                startingJackd = false;
-                parameters[kParameterBasePortNumber] = portBaseNum = -kErrorJackdExecFailed;
+            case Engine::kStatusStarting:
+                // the handshake below tells when jackd is ready, no need to wait for the next Runner cycle
+                startupProfiler.mark(StartupProfiler::kPhaseJackdSpawn);
+                jackdStarting = true;
+                break;
+            case Engine::kStatusFailed:
+                parameters[kParameterBasePortNumber] = portBaseNum = engine->getPortBaseNum();
                 return false;
+            case Engine::kStatusRunning:
+                break;
             }
 
-            const String appDir(getAppDir());
-            const String jackdStr(appDir + DISTRHO_OS_SEP_STR "jackd" APP_EXT);
-            const String jacksessionStr(appDir + DISTRHO_OS_SEP_STR "jack" DISTRHO_OS_SEP_STR "jack-session.conf");
-            const String servernameStr("mod-desktop-" + String(portBaseNum));
-            const String shmportStr(portBaseNum);
-
-            const char* const jackd_args[] = {
-                jackdStr.buffer(),
-                "-R",
-                "-S",
-                "-n", servernameStr.buffer(),
-                "-C", jacksessionStr.buffer(),
-                "-d", "mod-desktop",
-                "-r", "48000",
-                "-p", "128",
-                "-s", shmportStr,
-                nullptr
-            };
+            // a restarted jackd is a new peer, only swapped while the audio thread is not looking at the old one
+            if (! processing && shm.hasPeer() && ! shm.isPeerAlive())
+                shm.clearPeer();
 
-            startingJackd = true;
-            if (jackd.start(jackd_args, envp))
+            if (! shm.hasPeer() && ! shm.isInProcess())
             {
-                d_stderr("MOD Desktop: jackd exec ok");
-                return true;
+                if (InProcessServer* const server = engine->getInProcessServer())
+                    shm.setInProcessServer(InProcessServer::process, server);
+                else
+                   #ifdef DISTRHO_OS_WINDOWS
+                    shm.setPeer(engine->getJackd().getProcessHandle());
+                   #else
+                    shm.setPeer(engine->getJackd().getPid(), engine->getJackd().getExitFd());
+                   #endif
             }
- 
-            d_stderr("MOD Desktop: Failed to start jackd");
-            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorJackdExecFailed;
-            return false;
         }
 
-        startingJackd = false;
-
         if (! processing)
         {
-            if (shm.sync())
-                processing = true;
+            // extra clients need support from the jackd driver, use a dedicated engine otherwise
+            if (engineClient != 0)
+            {
+                switch (engine->getMultiClientSupport())
+                {
+                case Engine::kMultiClientUnknown:
+                    // client 0 has not synced yet, do not block on a client slot the driver might never serve
+                    return true;
+                case Engine::kMultiClientUnsupported:
+                    d_stderr("MOD Desktop: jackd does not support extra clients, starting a new engine");
+                    shm.deinit();
+                    detachEngine();
+                    return attachEngine();
+                case Engine::kMultiClientSupported:
+                    break;
+                }
+            }
 
-            return true;
-        }
+            // the loaded pedalboard needs a fixed rate, which for MOD plugins means 48kHz
+            const uint32_t requiredSampleRate = shm.getRequiredSampleRate();
 
-        if (! mod_ui.isRunning())
-        {
-            if (startingModUI)
+            if (requiredSampleRate != 0 && requiredSampleRate != engineSampleRate)
             {
-                d_stderr("MOD Desktop: Failed to get mod-ui to run");
-                startingModUI = false;
-                parameters[kParameterBasePortNumber] = portBaseNum = -kErrorModUiExecFailed;
-                return false;
+                if (engineSampleRate != 48000)
+                {
+                    d_stderr("MOD Desktop: pedalboard requires %u Hz, falling back to 48000 Hz", requiredSampleRate);
+
+                    nativeSampleRateSupported = false;
+                    engineSampleRate = 48000;
+                    restartEngine();
+                    return true;
+                }
+
+                // already at 48kHz, restarting would not help, keep running with what we have
+                if (unsupportedSampleRate != requiredSampleRate)
+                {
+                    d_stderr("MOD Desktop: pedalboard requires %u Hz, which is not supported, staying at 48000 Hz",
+                             requiredSampleRate);
+                    unsupportedSampleRate = requiredSampleRate;
+                }
             }
 
-            const String appDir(getAppDir());
-            const String moduiStr(appDir + DISTRHO_OS_SEP_STR "mod-ui" APP_EXT);
+            if (! shm.sync(jackdStarting ? SharedMemory::kStartupTimeoutNs : SharedMemory::kDefaultTimeoutNs))
+                return true;
 
-            const char* const mod_ui_args[] = {
-                moduiStr.buffer(),
-                nullptr
-            };
+            if (engineClient == 0)
+            {
+                const MutexLocker cml(engine->getLock());
+                engine->setServerFeatures(shm.getFeatures());
+            }
 
-            startingModUI = true;
-            if (mod_ui.start(mod_ui_args, envp))
+            // older jackd drivers only know about the default period size and 48kHz, restart with those
+            const bool periodSizeFallback = periodSize != SharedMemory::kDefaultPeriodSize
+                                         && ! shm.hasFeature(SharedMemory::kFeaturePeriodSize);
+            const bool sampleRateFallback = engineSampleRate != 48000
+                                         && ! shm.hasFeature(SharedMemory::kFeatureSampleRate);
+
+            if (periodSizeFallback || sampleRateFallback)
             {
-                d_stderr("MOD Desktop: mod-ui exec ok");
+                if (periodSizeFallback)
+                {
+                    d_stderr("MOD Desktop: jackd does not support period size %u, falling back to %u",
+                             periodSize, SharedMemory::kDefaultPeriodSize);
+
+                    periodSizeSupported = false;
+                    periodSize = SharedMemory::kDefaultPeriodSize;
+                }
+
+                if (sampleRateFallback)
+                {
+                    d_stderr("MOD Desktop: jackd does not support %u Hz, falling back to 48000 Hz", engineSampleRate);
+
+                    nativeSampleRateSupported = false;
+                    engineSampleRate = 48000;
+                }
+
+                restartEngine();
                 return true;
             }
 
-            d_stderr("MOD Desktop: Failed to start jackd");
-            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorModUiExecFailed;
-            return false;
+            startupProfiler.mark(StartupProfiler::kPhaseFirstSync);
+            parameters[kParameterBridgeResyncs] = shm.getNumResyncs();
+            bridgeChanged = true;
+            processing = true;
+            return true;
         }
 
-        if (startingModUI)
         {
-            d_stderr("MOD Desktop: Runner setup ok");
-            startingModUI = false;
+            const MutexLocker cml(engine->getLock());
+
+            // mod-ui is the biggest memory cost of an engine, in on-demand mode only start it when someone wants to see it
+            if (modUIMode == kModUIOnDemand && ! modUIRequested && ! hasSavedPedalboard && ! engine->isModUIRunning())
+            {
+                if (startupProfiler.hasReached(StartupProfiler::kPhaseFirstAudioBlock))
+                    reportStartup(true);
+
+                return true;
+            }
+
+            switch (engine->runModUI())
+            {
+            case Engine::kStatusStarting:
+                startupProfiler.mark(StartupProfiler::kPhaseModUISpawn);
+
+                // give the port to the UI as soon as mod-ui is ready, or try again on the next Runner cycle
+                if (! waitForModUI())
+                    return true;
+                break;
+            case Engine::kStatusFailed:
+                parameters[kParameterBasePortNumber] = portBaseNum = engine->getPortBaseNum();
+                return false;
+            case Engine::kStatusRunning:
+                break;
+            }
         }
 
+        // request handled, mod-ui is kept running from now on
+        modUIRequested = false;
         parameters[kParameterBasePortNumber] = portBaseNum;
+
+        startupProfiler.mark(StartupProfiler::kPhaseUIReady);
+        reportStartup(true);
         return true;
     }
 
+    // write the startup phase times to the startup report, once per instance
+    void reportStartup(const bool complete)
+    {
+        if (startupReported)
+            return;
+
+        startupReported = true;
+
+        char info[256] = {};
+        std::snprintf(info, sizeof(info) - 1,
+                      "{\"component\":\"plugin\",\"version\":\"%s\",\"complete\":%s,\"engine\":\"%s\","
+                      "\"modUI\":\"%s\",\"sampleRate\":%u,\"periodSize\":%u,\"phases\":",
+                      VERSION,
+                      complete ? "true" : "false",
+                      sharedEngine ? "shared" : inProcessEngine ? "in-process" : "separate",
+                      modUIMode == kModUIOnDemand ? "on-demand" : "always",
+                      engineSampleRate,
+                      periodSize);
+
+        const String report(info + startupProfiler.toJSON() + "}");
+        appendStartupReport(report);
+
+        d_stderr("MOD Desktop: startup %s", report.buffer());
+    }
+
+    // wait for a starting mod-ui to be ready, signaled through its notify fd.
+    // mod-ui versions without notify support, and all of them on Windows, are detected by probing the web server port.
+    // NOTE called with the engine lock held, which is only taken again briefly to check on mod-ui
+    bool waitForModUI()
+    {
+        const uint32_t timeout = d_gettime_ms() + kModUIStartupTimeout;
+        const uint webPort = kPortNumOffset + portBaseNum * 3 + 2;
+
+        const Mutex& lock(engine->getLock());
+       #ifndef DISTRHO_OS_WINDOWS
+        int notifyfd = engine->takeModUINotifyFd();
+       #endif
+        bool ready = false;
+
+        {
+            const MutexUnlocker cmu(lock);
+
+            while (! shouldRunnerStop())
+            {
+                ready = isPortListening(webPort);
+
+               #ifndef DISTRHO_OS_WINDOWS
+                if (! ready && notifyfd >= 0)
+                {
+                    bool closed;
+                    ready = ChildProcess::waitForNotify(notifyfd, kModUIStartupPollInterval, closed);
+
+                    // mod-ui exited or does not know about notifying, probing the port is all we have left
+                    if (closed)
+                    {
+                        close(notifyfd);
+                        notifyfd = -1;
+                    }
+                }
+                else
+               #endif
+                if (! ready)
+                {
+                    d_msleep(kModUIStartupPollInterval);
+                }
+
+                if (ready || d_gettime_ms() >= timeout)
+                    break;
+
+                const MutexLocker cml(lock);
+
+                if (! engine->isModUIRunning())
+                    break;
+            }
+        }
+
+       #ifndef DISTRHO_OS_WINDOWS
+        if (notifyfd >= 0)
+            close(notifyfd);
+       #endif
+
+        if (ready)
+            d_stderr("MOD Desktop: mod-ui ready");
+
+        return ready;
+    }
+
    /* --------------------------------------------------------------------------------------------------------
     * Information */
 
@@ -305,13 +488,43 @@ protected:
     */
     void initAudioPort(bool input, uint32_t index, AudioPort& port) override
     {
-        // treat meter audio ports as stereo
-        port.groupId = kPortGroupStereo;
+        if (index < 2)
+        {
+            port.groupId = kPortGroupStereo;
+        }
+        else if (index < kFirstCVPort)
+        {
+            port.groupId = kPortGroupAux1 + (index - 2) / 2;
+        }
+        else
+        {
+            port.hints = kAudioPortIsCV;
+            port.groupId = kPortGroupCV;
+        }
 
         // everything else is as default
         Plugin::initAudioPort(input, index, port);
     }
 
+   /**
+      Initialize the port group @a groupId.@n
+      This function will be called once,
+      shortly after the plugin is created and all audio ports and parameters have been enumerated.
+    */
+    void initPortGroup(const uint32_t groupId, PortGroup& portGroup) override
+    {
+        if (groupId == kPortGroupCV)
+        {
+            portGroup.name = "CV";
+            portGroup.symbol = "cv";
+            return;
+        }
+
+        const String num(groupId - kPortGroupAux1 + 1);
+        portGroup.name = "Aux " + num;
+        portGroup.symbol = "aux" + num;
+    }
+
    /**
       Initialize the parameter @a index.@n
       This function will be called once, shortly after the plugin is created.
@@ -328,6 +541,67 @@ protected:
             parameter.ranges.max = 512.f;
             parameter.ranges.def = 0.f;
             break;
+        case kParameterBridgeWaitMin:
+            parameter.hints = kParameterIsOutput;
+            parameter.name = "bridge wait min";
+            parameter.symbol = "bridge_wait_min";
+            parameter.unit = "ms";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 50.f;
+            parameter.ranges.def = 0.f;
+            break;
+        case kParameterBridgeWaitAvg:
+            parameter.hints = kParameterIsOutput;
+            parameter.name = "bridge wait avg";
+            parameter.symbol = "bridge_wait_avg";
+            parameter.unit = "ms";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 50.f;
+            parameter.ranges.def = 0.f;
+            break;
+        case kParameterBridgeWaitMax:
+            parameter.hints = kParameterIsOutput;
+            parameter.name = "bridge wait max";
+            parameter.symbol = "bridge_wait_max";
+            parameter.unit = "ms";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 50.f;
+            parameter.ranges.def = 0.f;
+            break;
+        case kParameterBridgeWaitP99:
+            parameter.hints = kParameterIsOutput;
+            parameter.name = "bridge wait p99";
+            parameter.symbol = "bridge_wait_p99";
+            parameter.unit = "ms";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 50.f;
+            parameter.ranges.def = 0.f;
+            break;
+        case kParameterDspLoad:
+            parameter.hints = kParameterIsOutput;
+            parameter.name = "DSP load";
+            parameter.symbol = "dsp_load";
+            parameter.unit = "%";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 100.f;
+            parameter.ranges.def = 0.f;
+            break;
+        case kParameterBridgeXruns:
+            parameter.hints = kParameterIsOutput | kParameterIsInteger;
+            parameter.name = "Bridge xruns";
+            parameter.symbol = "bridge_xruns";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 1000000.f;
+            parameter.ranges.def = 0.f;
+            break;
+        case kParameterBridgeResyncs:
+            parameter.hints = kParameterIsOutput | kParameterIsInteger;
+            parameter.name = "Bridge resyncs";
+            parameter.symbol = "bridge_resyncs";
+            parameter.ranges.min = 0.f;
+            parameter.ranges.max = 1000000.f;
+            parameter.ranges.def = 0.f;
+            break;
         }
     }
 
@@ -335,12 +609,106 @@ protected:
       Set a state key and default value.
       This function will be called once, shortly after the plugin is created.
     */
-    void initState(uint32_t, State& state) override
+    void initState(const uint32_t index, State& state) override
     {
-        state.hints = kStateIsFilenamePath | kStateIsOnlyForDSP;
-        state.key = "pedalboard";
-        state.defaultValue = "";
-        state.label = "Pedalboard";
+        switch (index)
+        {
+        case kStatePedalboard:
+            state.hints = kStateIsFilenamePath | kStateIsOnlyForDSP;
+            state.key = "pedalboard";
+            state.defaultValue = "";
+            state.label = "Pedalboard";
+            break;
+        case kStatePipelineDepth:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "pipeline-depth";
+            state.defaultValue = "0";
+            state.label = "Pipeline Depth";
+            state.description = "Number of periods processed in parallel with the host, adds latency";
+            break;
+        case kStatePeriodSize:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "period-size";
+            state.defaultValue = "128";
+            state.label = "Period Size";
+            state.description = "Processing period size of the MOD engine, either 16, 32, 64, 128, 256 or auto";
+            break;
+        case kStateWaitPolicy:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "wait-policy";
+            state.defaultValue = "sleep";
+            state.label = "Wait Policy";
+            state.description = "How to wait for the MOD engine, either sleep or spin (busy-wait briefly before sleeping)";
+            break;
+        case kStateEngine:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "engine";
+            state.defaultValue = "dedicated";
+            state.label = "Engine";
+            state.description = "Either run a dedicated MOD engine for this instance, or share one with other instances of the same host (needs a jackd driver with multi-client support, falls back to dedicated otherwise)";
+            break;
+        case kStateChannels:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "channels";
+            state.defaultValue = "2";
+            state.label = "Channels";
+           #ifdef MOD_DESKTOP_MULTICHANNEL
+            state.description = "Number of audio channels exchanged with the MOD engine, an even number up to 16, the last 4 being CV";
+           #else
+            state.description = "Number of audio channels exchanged with the MOD engine, only 2 in the stereo plugin";
+           #endif
+            break;
+        case kStateEngineRate:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "engine-rate";
+            state.defaultValue = "48000";
+            state.label = "Engine Sample Rate";
+            state.description = "Either run a dedicated MOD engine at 48000 Hz and resample, or at the host rate (native) unless the pedalboard requires 48000 Hz";
+            break;
+        case kStateEngineProcess:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "engine-process";
+            state.defaultValue = "separate";
+            state.label = "Engine Process";
+            state.description = "Either run a dedicated MOD engine as a separate process, or inside the plugin (in-process) for the lowest latency";
+            break;
+        case kStateModUI:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "mod-ui";
+            state.defaultValue = "always";
+            state.label = "MOD UI";
+            state.description = "When to start the MOD web interface, either always or on-demand (experimental, when opening the plugin UI, unless there is a saved pedalboard to load)";
+            break;
+        // NOTE runtime request sent by the plugin UI, never saved, see getState()
+        case kStateModUIRequest:
+            state.hints = 0x0;
+            state.key = "mod-ui-request";
+            state.defaultValue = "";
+            state.label = "MOD UI Request";
+            state.description = "Set by the plugin UI to start the MOD web interface in on-demand mode";
+            break;
+        case kStateHibernateDelay:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "hibernate-delay";
+            state.defaultValue = "0";
+            state.label = "Hibernate Delay";
+            state.description = "Seconds of host deactivation after which a dedicated MOD engine is frozen until reactivated, 0 to disable";
+            break;
+        case kStateEngineKeepAlive:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "engine-keep-alive";
+            state.defaultValue = "10";
+            state.label = "Engine Keep Alive";
+            state.description = "Seconds to keep a dedicated MOD engine running after removing this instance, so a new one with the same settings starts right away, 0 to disable";
+            break;
+        case kStateResamplerQuality:
+            state.hints = kStateIsOnlyForDSP;
+            state.key = "resampler-quality";
+            state.defaultValue = "32";
+            state.label = "Resampler Quality";
+            state.description = "Filter length used when the host and engine sample rates differ, one of 16, 32, 48 or 96";
+            break;
+        }
     }
 
    /* --------------------------------------------------------------------------------------------------------
@@ -371,6 +739,43 @@ protected:
         if (std::strcmp(key, "pedalboard") == 0)
             return currentPedalboard;
 
+        if (std::strcmp(key, "mod-ui") == 0)
+            return String(modUIMode == kModUIOnDemand ? "on-demand" : "always");
+
+        // runtime request only, nothing to save
+        if (std::strcmp(key, "mod-ui-request") == 0)
+            return String();
+
+        if (std::strcmp(key, "pipeline-depth") == 0)
+            return String(pipelineDepth);
+
+        if (std::strcmp(key, "period-size") == 0)
+            return periodSizeRequest != 0 ? String(periodSizeRequest) : String("auto");
+
+        if (std::strcmp(key, "wait-policy") == 0)
+            return String(waitPolicy == SharedMemory::kWaitPolicyAdaptiveSpin ? "spin" : "sleep");
+
+        if (std::strcmp(key, "channels") == 0)
+            return String(numChannelsRequest);
+
+        if (std::strcmp(key, "engine") == 0)
+            return String(sharedEngineRequest ? "shared" : "dedicated");
+
+        if (std::strcmp(key, "engine-keep-alive") == 0)
+            return String(engineKeepAlive);
+
+        if (std::strcmp(key, "hibernate-delay") == 0)
+            return String(hibernateDelay);
+
+        if (std::strcmp(key, "engine-rate") == 0)
+            return String(nativeSampleRateRequest ? "native" : "48000");
+
+        if (std::strcmp(key, "engine-process") == 0)
+            return String(inProcessEngineRequest ? "in-process" : "separate");
+
+        if (std::strcmp(key, "resampler-quality") == 0)
+            return String(resamplerQualityRequest);
+
         return String();
     }
 
@@ -380,7 +785,116 @@ protected:
     void setState(const char* const key, const char* const value) override
     {
         if (std::strcmp(key, "pedalboard") == 0)
+        {
             currentPedalboard = value;
+            hasSavedPedalboard = value[0] != '\0';
+            return;
+        }
+
+        // NOTE an already running mod-ui is kept running when switching to on-demand
+        if (std::strcmp(key, "mod-ui") == 0)
+        {
+            modUIMode = std::strcmp(value, "on-demand") == 0 ? kModUIOnDemand : kModUIAlways;
+            return;
+        }
+
+        if (std::strcmp(key, "mod-ui-request") == 0)
+        {
+            if (value[0] != '\0')
+                modUIRequested = true;
+            return;
+        }
+
+        // NOTE takes effect on next activation, as it changes latency
+        if (std::strcmp(key, "pipeline-depth") == 0)
+        {
+            pipelineDepth = std::min<uint>(kMaxPipelineDepth, std::max(0, std::atoi(value)));
+            return;
+        }
+
+        // NOTE takes effect on next activation, as it requires restarting the engine
+        if (std::strcmp(key, "period-size") == 0)
+        {
+            if (std::strcmp(value, "auto") == 0)
+            {
+                periodSizeRequest = 0;
+                return;
+            }
+
+            const int size = std::atoi(value);
+
+            if (size >= static_cast<int>(SharedMemory::kMinPeriodSize) &&
+                size <= static_cast<int>(SharedMemory::kMaxPeriodSize) &&
+                d_nextPowerOf2(size) == static_cast<uint32_t>(size))
+            {
+                periodSizeRequest = size;
+            }
+            return;
+        }
+
+        // NOTE takes effect on next activation
+        if (std::strcmp(key, "wait-policy") == 0)
+        {
+            waitPolicy = std::strcmp(value, "spin") == 0 ? SharedMemory::kWaitPolicyAdaptiveSpin
+                                                         : SharedMemory::kWaitPolicySleep;
+            return;
+        }
+
+        // NOTE takes effect on next activation
+        if (std::strcmp(key, "engine") == 0)
+        {
+            sharedEngineRequest = std::strcmp(value, "shared") == 0;
+            return;
+        }
+
+        // NOTE takes effect on next activation, as it requires restarting the engine
+        if (std::strcmp(key, "channels") == 0)
+        {
+            const int channels = std::atoi(value);
+
+            if (channels >= 2 && channels <= DISTRHO_PLUGIN_NUM_INPUTS && channels % 2 == 0)
+                numChannelsRequest = channels;
+            return;
+        }
+
+        // NOTE takes effect on next activation, as it requires restarting the engine
+        if (std::strcmp(key, "engine-rate") == 0)
+        {
+            nativeSampleRateRequest = std::strcmp(value, "native") == 0;
+            nativeSampleRateSupported = true;
+            return;
+        }
+
+        // NOTE takes effect on next activation, as it requires restarting the engine
+        if (std::strcmp(key, "engine-process") == 0)
+        {
+            inProcessEngineRequest = std::strcmp(value, "in-process") == 0;
+            return;
+        }
+
+        // NOTE takes effect on next deactivation
+        if (std::strcmp(key, "hibernate-delay") == 0)
+        {
+            hibernateDelay = std::min<uint>(kMaxHibernateDelay, std::max(0, std::atoi(value)));
+            return;
+        }
+
+        // NOTE takes effect when this instance is removed
+        if (std::strcmp(key, "engine-keep-alive") == 0)
+        {
+            engineKeepAlive = std::min<uint>(kMaxEngineKeepAlive, std::max(0, std::atoi(value)));
+            return;
+        }
+
+        // NOTE takes effect on next activation, as it changes latency
+        if (std::strcmp(key, "resampler-quality") == 0)
+        {
+            const int quality = std::atoi(value);
+
+            if (quality == 16 || quality == 32 || quality == 48 || quality == 96)
+                resamplerQualityRequest = quality;
+            return;
+        }
     }
 
    /* --------------------------------------------------------------------------------------------------------
@@ -388,36 +902,110 @@ protected:
 
     void activate() override
     {
+        // the engine needs to be restarted if the period size or its sample rate changed
+        const uint newSampleRate = getEngineSampleRateForHost();
+        const uint newPeriodSize = getPeriodSizeForHost(newSampleRate);
+        const bool newInProcessEngine = inProcessEngineRequest && ! sharedEngineRequest;
+
+        if (periodSize != newPeriodSize || engineSampleRate != newSampleRate || inProcessEngine != newInProcessEngine ||
+            numChannels != numChannelsRequest || sharedEngine != sharedEngineRequest)
+        {
+            inProcessEngine = newInProcessEngine;
+
+            if (! shouldStartRunner)
+                stopEngine();
+
+            periodSize = newPeriodSize;
+            shm.setPeriodSize(newPeriodSize);
+
+            if (engineSampleRate != newSampleRate)
+            {
+                engineSampleRate = newSampleRate;
+                setupResampler(getSampleRate());
+            }
+
+            if (numChannels != numChannelsRequest)
+            {
+                numChannels = numChannelsRequest;
+                shm.setNumChannels(numChannels);
+                setupResampler(getSampleRate());
+            }
+
+            // shared engines are matched by period size, dedicated ones are simply restarted with the new one
+            if (engine != nullptr && (sharedEngine || sharedEngineRequest))
+            {
+                sharedEngine = sharedEngineRequest;
+                shm.deinit();
+                detachEngine();
+                attachEngine();
+            }
+            else if (engine != nullptr)
+            {
+                const MutexLocker cml(engine->getLock());
+                engine->setPeriodSize(periodSize);
+                engine->setNumChannels(numChannels);
+                engine->setSampleRate(engineSampleRate);
+                engine->setInProcess(inProcessEngine);
+            }
+        }
+
+        if (shm.getWaitPolicy() != waitPolicy)
+            shm.setWaitPolicy(waitPolicy);
+
+        if (resamplerQuality != resamplerQualityRequest)
+        {
+            resamplerQuality = resamplerQualityRequest;
+            setupResampler(getSampleRate());
+        }
+
+        active = true;
+        startupProfiler.mark(StartupProfiler::kPhaseActivate);
+
+        if (engine != nullptr)
+        {
+            const MutexLocker cml(engine->getLock());
+            engine->wake();
+        }
+
         if (shouldStartRunner)
         {
             shouldStartRunner = false;
 
+            // a parked engine started with the same settings skips the cold start of our own
+            if (engine != nullptr && ! sharedEngine && ! engine->isJackdRunning())
+                adoptEngine();
+
             if (portBaseNum > 0 && run())
                 startRunner(500);
         }
 
-        // make sure we have enough space to cover everything
+        // make sure we have enough space to cover everything, assuming 48kHz for a possible fallback from native rate
         const double sampleRate = getSampleRate();
         const uint32_t bufferSize = getBufferSize();
         const uint32_t bufferSizeInput = bufferSize * (sampleRate / 48000.0);
         const uint32_t bufferSizeOutput = bufferSize * (48000.0 / sampleRate);
 
-        audioBufferIn.createBuffer(2, (bufferSizeInput + 8192) * 2);
-        audioBufferOut.createBuffer(2, (bufferSizeOutput + 8192) * 2);
+        audioBufferIn.createBuffer(numChannels, (bufferSizeInput + 8192) * 2);
+        audioBufferOut.createBuffer(numChannels, (bufferSizeOutput + 8192) * 2);
 
-        numSamplesInTempBuffers = d_nextPowerOf2((std::max(bufferSizeInput, bufferSizeOutput) + 256) * 2);
-        delete[] tempBuffers[0];
-        delete[] tempBuffers[1];
-        tempBuffers[0] = new float[numSamplesInTempBuffers];
-        tempBuffers[1] = new float[numSamplesInTempBuffers];
-        std::memset(tempBuffers[0], 0, sizeof(float) * numSamplesInTempBuffers);
-        std::memset(tempBuffers[1], 0, sizeof(float) * numSamplesInTempBuffers);
+        // period size can change while running, if the engine falls back to the default one
+        const uint32_t periodSizeOutput = SharedMemory::kMaxPeriodSize * (sampleRate / 48000.0);
 
-        numSamplesUntilProcessing = d_isNotEqual(sampleRate, 48000.0)
-                                  ? d_roundToUnsignedInt(128.0 * (sampleRate / 48000.0))
-                                  : 128;
+        numSamplesInTempBuffers = d_nextPowerOf2((std::max(std::max(bufferSizeInput, bufferSizeOutput), periodSizeOutput) + 256) * 2);
+        deleteTempBuffers();
+        for (uint c = 0; c < numChannels; ++c)
+        {
+            tempBuffers[c] = new float[numSamplesInTempBuffers];
+            std::memset(tempBuffers[c], 0, sizeof(float) * numSamplesInTempBuffers);
+        }
 
-        setLatency(numSamplesUntilProcessing);
+        pipelineDepthActive = pipelineDepth;
+        bridgeChanged = false;
+        resyncing = false;
+        updateLatency();
+
+        // publish bridge stats once per second of processed audio
+        bridgeStats.setWindowTime(1000000000);
 
         midiFrameOffset = 0.0;
         midiRecvBuffer = new uint8_t[kMaxMidiSize];
@@ -426,14 +1014,15 @@ protected:
 
     void deactivate() override
     {
+        deactivatedTime = d_gettime_ms();
+        active = false;
+
         audioBufferIn.deleteBuffer();
         audioBufferOut.deleteBuffer();
         midiRingBuffer.deleteBuffer();
 
-        delete[] tempBuffers[0];
-        delete[] tempBuffers[1];
+        deleteTempBuffers();
         delete[] midiRecvBuffer;
-        tempBuffers[0] = tempBuffers[1] = nullptr;
         midiRecvBuffer = nullptr;
         numSamplesInTempBuffers = 0;
     }
@@ -444,13 +1033,44 @@ protected:
     void run(const float** const inputs, float** const outputs, const uint32_t frames,
              const MidiEvent* const midiEvents, const uint32_t midiEventCount) override
     {
+        // resamplers are only touched while processing, as the Runner replaces them during an engine restart
         if (! processing)
         {
-            std::memset(outputs[0], 0, sizeof(float) * frames);
-            std::memset(outputs[1], 0, sizeof(float) * frames);
+            clearOutputs(outputs, 0, frames);
+            return;
+        }
+
+        if (bridgeChanged.exchange(false))
+            resetBridgeBuffers();
+
+        if (resyncing)
+        {
+            clearOutputs(outputs, 0, frames);
+
+            if (! shm.resync())
+                return;
+
+            resyncing = false;
+            resetBridgeBuffers();
+            parameters[kParameterBridgeResyncs] = shm.getNumResyncs();
             return;
         }
 
+        // the loaded pedalboard needs another rate, Runner restarts the engine at 48kHz
+        if (const uint32_t requiredSampleRate = shm.getRequiredSampleRate())
+        {
+            if (requiredSampleRate != engineSampleRate && engineSampleRate != 48000)
+            {
+                clearOutputs(outputs, 0, frames);
+                processing = false;
+                return;
+            }
+        }
+
+        // ports beyond the used channels are always silent
+        for (uint c = numChannels; c < DISTRHO_PLUGIN_NUM_OUTPUTS; ++c)
+            std::memset(outputs[c], 0, sizeof(float) * frames);
+
         const double resampledFrames = frames * resamplerRatio;
 
         if (resamplerTo48kHz != nullptr)
@@ -483,114 +1103,87 @@ protected:
         }
 
         midiFrameOffset += resampledFrames;
+        const double midiFrameOffsetStart = midiFrameOffset;
         uint midiFrameOffsetLocal = 0;
+        uint midiFrameOffsetLocalOut = 0;
         uint lastMidiOutFrame = 0;
 
-        while (audioBufferIn.getNumReadableSamples() >= 128)
-        {
-            float* shmbuffers[2] = { shm.data->audio, shm.data->audio + 128 };
+        // the host expects us back within its buffer duration, leave some room for resampling and the host itself
+        const uint64_t deadline = SharedMemory::getMonotonicTime()
+                                + static_cast<uint64_t>(frames * 800000000.0 / getSampleRate());
 
-            audioBufferIn.read(shmbuffers, 128);
+        while (audioBufferIn.getNumReadableSamples() >= periodSize)
+        {
+            // queue as many periods as possible, so we only wake up the server once per host callback
+            const uint maxPeriods = shm.getMaxPeriods();
+            uint numPeriods = 0;
 
-            uint midiFrame, midiSize, shmMidiEventCount = 0;
-            while (midiRingBuffer.isDataAvailableForReading())
+            // server side is still busy with late periods, drop input and output silence in its place
+            if (maxPeriods == 0)
             {
-                midiFrame = midiRingBuffer.peekUInt();
-
-                if (midiFrame < midiFrameOffsetLocal)
-                    midiFrame = 0;
-                else
-                    midiFrame -= midiFrameOffsetLocal;
-
-                if (midiFrame >= 128)
-                    break;
-
-                midiRingBuffer.readUInt();
-                midiSize = midiRingBuffer.readUInt();
-                if (midiSize < kMaxMidiSize && midiRingBuffer.readCustomData(midiRecvBuffer, midiSize))
+                if (shm.isStalled())
                 {
-                    // TODO
-                    if (midiSize > 4)
-                        continue;
-
-                    // TODO data pool
-                    shm.data->midiFrames[shmMidiEventCount] = midiFrame;
-                    for (uint32_t i = 0; i < midiSize; ++i)
-                        shm.data->midiData[shmMidiEventCount * 4 + i] = midiRecvBuffer[i];
-                    for (uint32_t i = midiSize; i < 4; ++i)
-                        shm.data->midiData[shmMidiEventCount * 4 + i] = 0;
-
-                    if (++shmMidiEventCount == 511)
-                        break;
-                }
-                else
-                {
-                    d_stderr("midi ringbuffer data race, ignoring future events");
-                    midiRingBuffer.flush();
-                    break;
+                    clearOutputs(outputs, 0, frames);
+                    startResync();
+                    return;
                 }
+
+                writePeriod(&discardPeriod, midiFrameOffsetLocal);
+                midiFrameOffsetLocal += periodSize;
+                midiFrameOffset = std::max(0.0, midiFrameOffset - periodSize);
+
+                readPeriod(shm.getSilentPeriod(),
+                           midiFrameOffsetLocalOut,
+                           std::max(0.0, midiFrameOffsetStart - midiFrameOffsetLocalOut) - resampledFrames,
+                           frames,
+                           lastMidiOutFrame);
+                midiFrameOffsetLocalOut += periodSize;
+                continue;
             }
 
-            shm.data->midiEventCount = shmMidiEventCount;
+            do {
+                writePeriod(shm.getWritePeriod(numPeriods), midiFrameOffsetLocal);
 
-            if (! shm.process())
+                midiFrameOffsetLocal += periodSize;
+                midiFrameOffset = std::max(0.0, midiFrameOffset - periodSize);
+            } while (++numPeriods != maxPeriods && audioBufferIn.getNumReadableSamples() >= periodSize);
+
+            // in pipelined mode only wait for the oldest periods, the rest is collected on later calls
+            // a lost wake-up shows up as a stall on the next call, only a dead server side fails here
+            if (! shm.processPeriods(numPeriods, pipelineDepthActive, deadline))
             {
+                // jackd is gone, Runner takes care of restarting it
                 d_stderr("shm processing failed");
+                clearOutputs(outputs, 0, frames);
                 processing = false;
-                std::memset(outputs[0], 0, sizeof(float) * frames);
-                std::memset(outputs[1], 0, sizeof(float) * frames);
                 return;
             }
 
-            if (resamplerFrom48kHz != nullptr)
-            {
-                resamplerFrom48kHz->inp_count = 128;
-                resamplerFrom48kHz->out_count = numSamplesInTempBuffers;
-                resamplerFrom48kHz->inp_data = shmbuffers;
-                resamplerFrom48kHz->out_data = tempBuffers;
-                resamplerFrom48kHz->process();
-                DISTRHO_SAFE_ASSERT(resamplerFrom48kHz->inp_count == 0);
-
-                audioBufferOut.write(tempBuffers, numSamplesInTempBuffers - resamplerFrom48kHz->out_count);
-            }
-            else
-            {
-                audioBufferOut.write(shmbuffers, 128);
-            }
+            updateBridgeStats(numPeriods);
+            startupProfiler.mark(StartupProfiler::kPhaseFirstAudioBlock);
 
-            // TODO ring buffer out
-            for (uint16_t i = 0; i < shm.data->midiEventCount; ++i)
+            const uint numReadablePeriods = shm.getNumReadablePeriods();
+
+            for (uint i = 0; i < numReadablePeriods; ++i)
             {
-                // so bad..
-                midiFrame = std::min<uint>(frames - 1, std::max(0.0, shm.data->midiFrames[i] + midiFrameOffsetLocal - (midiFrameOffset - resampledFrames)) / resamplerRatio);
-                lastMidiOutFrame = std::max(midiFrame, lastMidiOutFrame);
+                readPeriod(shm.getReadPeriod(i),
+                           midiFrameOffsetLocalOut,
+                           std::max(0.0, midiFrameOffsetStart - midiFrameOffsetLocalOut) - resampledFrames,
+                           frames,
+                           lastMidiOutFrame);
 
-                // TODO data pool
-                MidiEvent midiEvent = {
-                    midiFrame,
-                    4,
-                    {
-                        shm.data->midiData[i * 4 + 0],
-                        shm.data->midiData[i * 4 + 1],
-                        shm.data->midiData[i * 4 + 2],
-                        shm.data->midiData[i * 4 + 3],
-                    },
-                    nullptr
-                };
-
-                if (! writeMidiEvent(midiEvent))
-                    break;
+                midiFrameOffsetLocalOut += periodSize;
             }
 
-            midiFrameOffsetLocal += 128;
-            midiFrameOffset = std::max(0.0, midiFrameOffset - 128);
+            shm.releasePeriods(numReadablePeriods);
         }
 
+        parameters[kParameterBridgeXruns] = shm.getNumXruns();
+
         if (numSamplesUntilProcessing >= frames)
         {
             numSamplesUntilProcessing -= frames;
-            std::memset(outputs[0], 0, sizeof(float) * frames);
-            std::memset(outputs[1], 0, sizeof(float) * frames);
+            clearOutputs(outputs, 0, frames);
             return;
         }
 
@@ -600,13 +1193,12 @@ protected:
             const uint32_t remaining = frames - start;
             numSamplesUntilProcessing = 0;
 
-            std::memset(outputs[0], 0, sizeof(float) * start);
-            std::memset(outputs[1], 0, sizeof(float) * start);
+            clearOutputs(outputs, 0, start);
+
+            float* offsetbuffers[SharedMemory::kMaxChannels];
+            for (uint c = 0; c < numChannels; ++c)
+                offsetbuffers[c] = outputs[c] + start;
 
-            float* offsetbuffers[2] = {
-                outputs[0] + start,
-                outputs[1] + start,
-            };
             audioBufferOut.read(offsetbuffers, remaining);
             return;
         }
@@ -624,35 +1216,373 @@ protected:
         }
     }
 
+    // get the bridge back in sync with a still running jackd
+    // done in the audio thread when possible, as it only takes a few periods, otherwise on the next Runner call
+    void startResync()
+    {
+        if (shm.getServerVersion() >= SharedMemory::kProtocolVersion)
+        {
+            resyncing = true;
+            shm.resync();
+        }
+        else
+        {
+            processing = false;
+        }
+    }
+
+    // start over with empty buffers and reported latency, as if just activated
+    void resetBridgeBuffers()
+    {
+        audioBufferIn.flush();
+        audioBufferOut.flush();
+        midiRingBuffer.flush();
+        midiFrameOffset = 0.0;
+        primeResamplers();
+        updateLatency();
+    }
+
+    // aggregate timings of the last processing cycle, publishing them as output parameters
+    void updateBridgeStats(const uint numPeriods)
+    {
+        const SharedMemory::Timings& timings(shm.getTimings());
+        const uint64_t waitTime = timings.pluginResume - timings.pluginPost;
+
+        const uint64_t cycleTime = numPeriods * periodSize * (1000000000.0 / engineSampleRate);
+
+        double load = -1.0;
+        if (shm.hasFeature(SharedMemory::kFeatureTimings) && timings.serverWake >= timings.pluginPost && timings.serverDone >= timings.serverWake)
+            load = static_cast<double>(timings.serverDone - timings.serverWake) / cycleTime;
+
+        if (! bridgeStats.addCycle(waitTime, cycleTime, load))
+            return;
+
+        const BridgeStats::Summary& summary(bridgeStats.getSummary());
+        parameters[kParameterBridgeWaitMin] = summary.waitMin;
+        parameters[kParameterBridgeWaitAvg] = summary.waitAvg;
+        parameters[kParameterBridgeWaitMax] = summary.waitMax;
+        parameters[kParameterBridgeWaitP99] = summary.waitP99;
+        parameters[kParameterDspLoad] = std::min(100.f, summary.dspLoad);
+    }
+
+    // write the next period worth of audio and MIDI into shared memory
+    void writePeriod(SharedMemory::Period* const period, const uint midiFrameOffsetLocal)
+    {
+        float* shmbuffers[SharedMemory::kMaxChannels];
+        for (uint c = 0; c < numChannels; ++c)
+            shmbuffers[c] = period->audio + c * periodSize;
+
+        audioBufferIn.read(shmbuffers, periodSize);
+
+        uint midiFrame, midiSize, shmMidiEventCount = 0;
+        while (midiRingBuffer.isDataAvailableForReading())
+        {
+            midiFrame = midiRingBuffer.peekUInt();
+
+            if (midiFrame < midiFrameOffsetLocal)
+                midiFrame = 0;
+            else
+                midiFrame -= midiFrameOffsetLocal;
+
+            if (midiFrame >= periodSize)
+                break;
+
+            midiRingBuffer.readUInt();
+            midiSize = midiRingBuffer.readUInt();
+            if (midiSize < kMaxMidiSize && midiRingBuffer.readCustomData(midiRecvBuffer, midiSize))
+            {
+                // TODO
+                if (midiSize > 4)
+                    continue;
+
+                // TODO data pool
+                period->midiFrames[shmMidiEventCount] = midiFrame;
+                for (uint32_t i = 0; i < midiSize; ++i)
+                    period->midiData[shmMidiEventCount * 4 + i] = midiRecvBuffer[i];
+                for (uint32_t i = midiSize; i < 4; ++i)
+                    period->midiData[shmMidiEventCount * 4 + i] = 0;
+
+                if (++shmMidiEventCount == 511)
+                    break;
+            }
+            else
+            {
+                d_stderr("midi ringbuffer data race, ignoring future events");
+                midiRingBuffer.flush();
+                break;
+            }
+        }
+
+        period->midiEventCount = shmMidiEventCount;
+    }
+
+    // read back a processed period of audio and MIDI from shared memory
+    void readPeriod(const SharedMemory::Period* const period,
+                    const uint midiFrameOffsetLocal,
+                    const double midiFrameOffsetBase,
+                    const uint32_t frames,
+                    uint& lastMidiOutFrame)
+    {
+        // channels not known to the server side still contain our input, replace them with silence
+        const uint numActiveChannels = shm.getNumActiveChannels();
+        const float* shmbuffers[SharedMemory::kMaxChannels];
+        for (uint c = 0; c < numChannels; ++c)
+            shmbuffers[c] = c < numActiveChannels ? period->audio + c * periodSize
+                                                  : shm.getSilentPeriod()->audio;
+
+        if (resamplerFrom48kHz != nullptr)
+        {
+            resamplerFrom48kHz->inp_count = periodSize;
+            resamplerFrom48kHz->out_count = numSamplesInTempBuffers;
+            resamplerFrom48kHz->inp_data = shmbuffers;
+            resamplerFrom48kHz->out_data = tempBuffers;
+            resamplerFrom48kHz->process();
+            DISTRHO_SAFE_ASSERT(resamplerFrom48kHz->inp_count == 0);
+
+            audioBufferOut.write(tempBuffers, numSamplesInTempBuffers - resamplerFrom48kHz->out_count);
+        }
+        else
+        {
+            audioBufferOut.write(shmbuffers, periodSize);
+        }
+
+        // TODO ring buffer out
+        for (uint16_t i = 0; i < period->midiEventCount; ++i)
+        {
+            // so bad..
+            const uint midiFrame = std::min<uint>(frames - 1, std::max(0.0, period->midiFrames[i] + midiFrameOffsetLocal - midiFrameOffsetBase) / resamplerRatio);
+            lastMidiOutFrame = std::max(midiFrame, lastMidiOutFrame);
+
+            // TODO data pool
+            MidiEvent midiEvent = {
+                midiFrame,
+                4,
+                {
+                    period->midiData[i * 4 + 0],
+                    period->midiData[i * 4 + 1],
+                    period->midiData[i * 4 + 2],
+                    period->midiData[i * 4 + 3],
+                },
+                nullptr
+            };
+
+            if (! writeMidiEvent(midiEvent))
+                break;
+        }
+    }
+
+    // unless in native rate mode jackd always runs at 48kHz, only the resamplers depend on the host rate
+    // the engine and its pedalboard stay untouched, buffers are resized on the next activation
     void sampleRateChanged(const double sampleRate) override
     {
-        if (portBaseNum < 0 || shm.data == nullptr)
+        if (portBaseNum < 0)
             return;
 
+        setupResampler(sampleRate);
+    }
+
+    // restart jackd with new settings from the Runner thread, while the audio thread is not processing
+    void restartEngine()
+    {
+        shm.stopWait();
+        {
+            const MutexLocker cml(engine->getLock());
+            engine->stopJackd();
+            engine->setPeriodSize(periodSize);
+            engine->setSampleRate(engineSampleRate);
+        }
+        shm.deinit();
+
+        shm.setPeriodSize(periodSize);
+        setupResampler(getSampleRate());
+        bridgeChanged = true;
+    }
+
+    // stop jackd and related processing, Runner will start it again on the next activation
+    // when detaching for good, a dedicated jackd is left running in case its engine gets parked
+    void stopEngine(const bool detaching = false)
+    {
+        // do not keep the Runner waiting on a jackd startup
+        shm.abortSync();
         stopRunner();
 
-        if (processing && jackd.isRunning())
+        if (engine != nullptr)
         {
-            processing = false;
-            shm.stopWait();
+            const MutexLocker cml(engine->getLock());
+
+            // a frozen jackd would never acknowledge the stop request
+            engine->wake();
+
+            // nothing to drain once jackd has exited, even if not reaped yet
+            if (processing && engine->isJackdRunning() && shm.isPeerAlive())
+                shm.stopWait();
+
+            // shared engines keep running for other clients, until the last one detaches
+            if (! engine->isShared() && ! detaching)
+                engine->stopJackd();
         }
 
-        jackd.stop();
+        processing = false;
+
+        if (shm.data != nullptr)
+            d_stderr("MOD Desktop: shm waits resolved by spinning %u, by sleeping %u",
+                     shm.getNumSpinWaits(), shm.getNumSleepWaits());
+
         shm.deinit();
-        setupResampler(sampleRate);
 
         shouldStartRunner = true;
     }
 
+    // get a jackd/mod-ui engine for this instance, shared with other instances if requested
+    bool attachEngine()
+    {
+        engine = Engine::acquire(sharedEngine, periodSize, engineClient);
+        portBaseNum = engine->getPortBaseNum();
+
+        if (portBaseNum < 0)
+        {
+            parameters[kParameterBasePortNumber] = portBaseNum;
+            return false;
+        }
+
+        if (engineClient == 0)
+        {
+            engine->setNumChannels(numChannels);
+            engine->setSampleRate(engineSampleRate);
+            engine->setInProcess(inProcessEngine);
+        }
+
+        if (! shm.init(portBaseNum, engineClient))
+        {
+            d_stderr("MOD Desktop: Failed to init shared memory");
+            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorShmSetupFailed;
+            return false;
+        }
+
+        return true;
+    }
+
+    // swap our not yet started dedicated engine for a parked one with the same settings, if any
+    void adoptEngine()
+    {
+        Engine* const parked = Engine::adopt(periodSize, numChannels, engineSampleRate, inProcessEngine);
+
+        if (parked == nullptr)
+            return;
+
+        // our own engine never started, deleting it also gives back the port it claimed in the registry
+        shm.deinit();
+        detachEngine();
+
+        engine = parked;
+        portBaseNum = engine->getPortBaseNum();
+
+        {
+            const MutexLocker cml(engine->getLock());
+            engine->wake();
+        }
+
+        adoptedGraphPending = true;
+
+        if (! shm.init(portBaseNum, engineClient))
+        {
+            d_stderr("MOD Desktop: Failed to init shared memory");
+            parameters[kParameterBasePortNumber] = portBaseNum = -kErrorShmSetupFailed;
+        }
+    }
+
+    void detachEngine(const uint32_t keepAliveMs = 0)
+    {
+        if (engine == nullptr)
+            return;
+
+        Engine::release(engine, engineClient, keepAliveMs);
+        engine = nullptr;
+        engineClient = 0;
+    }
+
+    // get the sample rate to run the engine at, only dedicated engines follow the host rate
+    uint getEngineSampleRateForHost() const
+    {
+        if (! nativeSampleRateRequest || ! nativeSampleRateSupported || sharedEngineRequest)
+            return 48000;
+
+        return d_roundToUnsignedInt(getSampleRate());
+    }
+
+    // get the period size to use for the engine, following the host buffer size if set to auto
+    uint getPeriodSizeForHost(const uint sampleRate) const
+    {
+        if (! periodSizeSupported)
+            return SharedMemory::kDefaultPeriodSize;
+
+        if (periodSizeRequest != 0)
+            return periodSizeRequest;
+
+        const double bufferSizeAtEngineRate = getBufferSize() * (sampleRate / getSampleRate());
+
+        uint size = SharedMemory::kMaxPeriodSize;
+        while (size > SharedMemory::kMinPeriodSize && size > bufferSizeAtEngineRate)
+            size /= 2;
+
+        return size;
+    }
+
+    // periods being processed in parallel with the host are reported as extra latency
+    void updateLatency()
+    {
+        const double sampleRate = getSampleRate();
+        const uint latencyAtEngineRate = periodSize * (1 + pipelineDepthActive);
+
+        if (resamplerTo48kHz != nullptr)
+        {
+            // primed resamplers keep the signal aligned, but still need to look ahead by half their filter length
+            // before producing a sample, delay output by that amount in both directions so the reading never underruns
+            const double lookaheadAtEngineRate = resamplerFrom48kHz->inpsize() / 2 + 1;
+            const double lookahead = resamplerTo48kHz->inpsize() / 2 + 1
+                                   + lookaheadAtEngineRate * (sampleRate / engineSampleRate);
+
+            numSamplesUntilProcessing = d_roundToUnsignedInt(latencyAtEngineRate * (sampleRate / engineSampleRate)
+                                                             + std::ceil(lookahead));
+        }
+        else
+        {
+            numSamplesUntilProcessing = latencyAtEngineRate;
+        }
+
+        setLatency(numSamplesUntilProcessing);
+    }
+
+    void deleteTempBuffers()
+    {
+        for (uint c = 0; c < SharedMemory::kMaxChannels; ++c)
+        {
+            delete[] tempBuffers[c];
+            tempBuffers[c] = nullptr;
+        }
+    }
+
+    // silence all output ports within a frame range
+    static void clearOutputs(float** const outputs, const uint32_t offset, const uint32_t frames)
+    {
+        for (uint c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; ++c)
+            std::memset(outputs[c] + offset, 0, sizeof(float) * frames);
+    }
+
+    // resampling is skipped when the engine runs at the host rate
+    // NOTE the audio thread is either inactive or not processing while this is called
     void setupResampler(const double sampleRate)
     {
-        if (d_isNotEqual(sampleRate, 48000.0))
+        const MutexLocker cml(resamplerMutex);
+
+        if (d_isNotEqual(sampleRate, static_cast<double>(engineSampleRate)))
         {
             resamplerTo48kHz = new Resampler();
-            resamplerTo48kHz->setup(sampleRate, 48000, 2, 32);
+            resamplerTo48kHz->setup(sampleRate, engineSampleRate, numChannels, resamplerQuality);
             resamplerFrom48kHz = new Resampler();
-            resamplerFrom48kHz->setup(48000, sampleRate, 2, 32);
-            resamplerRatio = sampleRate / 48000.0;
+            resamplerFrom48kHz->setup(engineSampleRate, sampleRate, numChannels, resamplerQuality);
+            resamplerRatio = sampleRate / engineSampleRate;
+            primeResamplers();
         }
         else
         {
@@ -662,6 +1592,45 @@ protected:
         }
     }
 
+    // start the resamplers over, fed with half their filter length of silence so output lines up with input
+    // without it the signal would come out early and the reported latency would not match
+    void primeResamplers()
+    {
+        if (resamplerTo48kHz != nullptr)
+            primeResampler(resamplerTo48kHz, numChannels);
+        if (resamplerFrom48kHz != nullptr)
+            primeResampler(resamplerFrom48kHz, numChannels);
+    }
+
+    static void primeResampler(Resampler* const resampler, const uint numChannels)
+    {
+        static constexpr const uint kSilenceSize = 128;
+        static const float silence[kSilenceSize] = {};
+        float discard = 0.f;
+
+        const float* inputs[SharedMemory::kMaxChannels];
+        float* outputs[SharedMemory::kMaxChannels];
+        for (uint c = 0; c < numChannels; ++c)
+        {
+            inputs[c] = silence;
+            outputs[c] = &discard;
+        }
+
+        resampler->reset();
+
+        // not enough input to produce any output yet, out_count only needs to be non-zero
+        for (uint remaining = resampler->inpsize() / 2 - 1; remaining != 0;)
+        {
+            const uint count = std::min(remaining, kSilenceSize);
+            resampler->inp_count = count;
+            resampler->out_count = 1;
+            resampler->inp_data = inputs;
+            resampler->out_data = outputs;
+            resampler->process();
+            remaining -= count;
+        }
+    }
+
     // -------------------------------------------------------------------------------------------------------
 
    /**
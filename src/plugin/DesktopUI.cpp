@@ -71,6 +71,9 @@ public:
         {
             setGeometryConstraints(DISTRHO_UI_DEFAULT_WIDTH - 100, DISTRHO_UI_DEFAULT_HEIGHT);
         }
+
+        // in on-demand mode mod-ui is started once the UI is opened, which is now
+        setState("mod-ui-request", "true");
     }
 
     ~DesktopUI() override
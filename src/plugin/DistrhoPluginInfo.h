@@ -3,6 +3,21 @@
 
 #pragma once
 
+// the regular plugin keeps its stereo layout, so existing sessions and hosts see the same ports as always
+// the multichannel variant is a separate plugin built with MULTICHANNEL=true, see Makefile
+#ifdef MOD_DESKTOP_MULTICHANNEL
+#define DISTRHO_PLUGIN_BRAND   "MOD Audio"
+#define DISTRHO_PLUGIN_NAME    "MOD Desktop Multichannel"
+#define DISTRHO_PLUGIN_URI     "https://mod.audio/desktop/multichannel/"
+#define DISTRHO_PLUGIN_CLAP_ID "audio.mod.desktop.multichannel"
+
+#define DISTRHO_PLUGIN_BRAND_ID  MODa
+#define DISTRHO_PLUGIN_UNIQUE_ID dskm
+
+#define DISTRHO_PLUGIN_NUM_INPUTS       16
+#define DISTRHO_PLUGIN_NUM_OUTPUTS      16
+#define DISTRHO_PLUGIN_EXTRA_IO         { 2, 2 }
+#else
 #define DISTRHO_PLUGIN_BRAND   "MOD Audio"
 #define DISTRHO_PLUGIN_NAME    "MOD Desktop"
 #define DISTRHO_PLUGIN_URI     "https://mod.audio/desktop/"
@@ -11,10 +26,12 @@
 #define DISTRHO_PLUGIN_BRAND_ID  MODa
 #define DISTRHO_PLUGIN_UNIQUE_ID dskt
 
-#define DISTRHO_PLUGIN_HAS_UI           1
-#define DISTRHO_PLUGIN_IS_RT_SAFE       0
 #define DISTRHO_PLUGIN_NUM_INPUTS       2
 #define DISTRHO_PLUGIN_NUM_OUTPUTS      2
+#endif
+
+#define DISTRHO_PLUGIN_HAS_UI           1
+#define DISTRHO_PLUGIN_IS_RT_SAFE       0
 #define DISTRHO_PLUGIN_WANT_LATENCY     1
 #define DISTRHO_PLUGIN_WANT_MIDI_INPUT  1
 #define DISTRHO_PLUGIN_WANT_MIDI_OUTPUT 1
@@ -31,6 +48,10 @@
 static const constexpr unsigned int kVerticalOffset = 30;
 static const constexpr unsigned int kPortNumOffset = 18190;
 
+// multichannel audio port layout, the same for inputs and outputs: main stereo pair, stereo aux pairs and CV ports at the end
+static const constexpr unsigned int kNumAuxPairs = 5;
+static const constexpr unsigned int kFirstCVPort = 12;
+
 enum Error {
     kErrorAppDirNotFound = 1,
     kErrorJackdExecFailed,
@@ -39,7 +60,40 @@ enum Error {
     kErrorUndefined
 };
 
+enum PortGroups {
+    kPortGroupAux1,
+    kPortGroupAux2,
+    kPortGroupAux3,
+    kPortGroupAux4,
+    kPortGroupAux5,
+    kPortGroupCV
+};
+
 enum Parameters {
     kParameterBasePortNumber,
+    kParameterBridgeWaitMin,
+    kParameterBridgeWaitAvg,
+    kParameterBridgeWaitMax,
+    kParameterBridgeWaitP99,
+    kParameterDspLoad,
+    kParameterBridgeXruns,
+    kParameterBridgeResyncs,
     kParameterCount
 };
+
+enum States {
+    kStatePedalboard,
+    kStatePipelineDepth,
+    kStatePeriodSize,
+    kStateWaitPolicy,
+    kStateChannels,
+    kStateEngine,
+    kStateEngineKeepAlive,
+    kStateEngineRate,
+    kStateEngineProcess,
+    kStateModUI,
+    kStateModUIRequest,
+    kStateHibernateDelay,
+    kStateResamplerQuality,
+    kStateCount
+};
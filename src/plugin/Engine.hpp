@@ -0,0 +1,593 @@
+// SPDX-FileCopyrightText: 2023-2024 MOD Audio UG
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#pragma once
+
+#include "ChildProcess.hpp"
+#include "DistrhoPluginInfo.h"
+#include "InProcessServer.hpp"
+#include "InstanceRegistry.hpp"
+#include "SharedMemory.hpp"
+#include "extra/Mutex.hpp"
+#include "extra/String.hpp"
+#include "extra/Thread.hpp"
+#include "utils.hpp"
+
+#ifdef DISTRHO_OS_WINDOWS
+# define APP_EXT ".exe"
+#else
+# define APP_EXT ""
+#endif
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+// The jackd and mod-ui processes behind plugin instances.
+// Either dedicated to a single instance, or shared between all instances of the same process that opt-in to it.
+// Each instance attached to an engine is a client with its own shm segment, client 0 being the one jackd starts with.
+// Process related methods need the engine lock, as they are called from the Runner thread of each client.
+// Dedicated engines can also run jackd inside the plugin process, see InProcessServer.
+// Dedicated engines can outlive their last client for a while, parked until adopted by a new matching instance.
+
+class Engine
+{
+public:
+    enum Status {
+        kStatusStarting,
+        kStatusRunning,
+        kStatusFailed
+    };
+
+    enum MultiClientSupport {
+        kMultiClientUnknown,
+        kMultiClientSupported,
+        kMultiClientUnsupported
+    };
+
+    // get an engine for a new client, creating one if needed
+    // shared engines are reused by clients with the same period size
+    static Engine* acquire(const bool shared, const uint periodSize, uint& client)
+    {
+        Pool& pool(getPool());
+        const MutexLocker cml(pool.mutex);
+
+        if (shared)
+        {
+            for (Engine* engine = pool.engines; engine != nullptr; engine = engine->next)
+            {
+                if (! engine->shared || engine->periodSize != periodSize || engine->portBaseNum < 0)
+                    continue;
+                if (engine->multiClient == kMultiClientUnsupported)
+                    continue;
+
+                for (uint c = 0; c < SharedMemory::kMaxClients; ++c)
+                {
+                    if ((engine->clients & (1u << c)) != 0)
+                        continue;
+
+                    d_stderr("MOD Desktop: attaching to shared engine on port %d as client %u", engine->portBaseNum, c);
+                    engine->clients |= 1u << c;
+                    client = c;
+                    return engine;
+                }
+            }
+        }
+
+        Engine* const engine = new Engine(shared, periodSize);
+        engine->clients = 1;
+        engine->next = pool.engines;
+        pool.engines = engine;
+        client = 0;
+        return engine;
+    }
+
+    // take over a parked engine started with the same settings, if any
+    // the new client syncs with its already running jackd, skipping the cold start
+    static Engine* adopt(const uint periodSize, const uint numChannels, const uint sampleRate, const bool inProcess)
+    {
+        Pool& pool(getPool());
+        Engine* adopted = nullptr;
+        Engine* dead = nullptr;
+
+        {
+            const MutexLocker cml(pool.mutex);
+
+            for (Engine** it = &pool.parked; *it != nullptr;)
+            {
+                Engine* const engine = *it;
+
+                if (engine->periodSize != periodSize || engine->numChannels != numChannels ||
+                    engine->sampleRate != sampleRate || engine->inProcess != inProcess)
+                {
+                    it = &engine->next;
+                    continue;
+                }
+
+                *it = engine->next;
+
+                // jackd exited while parked, another match might still be usable
+                if (! engine->isJackdRunning())
+                {
+                    engine->next = dead;
+                    dead = engine;
+                    continue;
+                }
+
+                d_stderr("MOD Desktop: adopting parked engine on port %d", engine->portBaseNum);
+                engine->clients = 1;
+                engine->next = pool.engines;
+                pool.engines = engine;
+                adopted = engine;
+                break;
+            }
+        }
+
+        // stopping processes takes a while, do it without blocking other instances
+        Pool::deleteAll(dead);
+        return adopted;
+    }
+
+    // detach a client, the engine is stopped and deleted after the last one
+    // unless kept alive for the given time, which parks it for adoption by a new instance
+    static void release(Engine* const engine, const uint client, const uint32_t keepAliveMs = 0)
+    {
+        Pool& pool(getPool());
+        const MutexLocker cml(pool.mutex);
+
+        engine->clients &= ~(1u << client);
+
+        if (engine->clients != 0)
+            return;
+
+        for (Engine** it = &pool.engines; *it != nullptr; it = &(*it)->next)
+        {
+            if (*it == engine)
+            {
+                *it = engine->next;
+                break;
+            }
+        }
+
+        // the server side must be able to pick up the segment of a new client 0, see kFeatureReattach
+        if (keepAliveMs != 0 && ! engine->shared && engine->reattach && engine->isJackdRunning())
+        {
+            d_stderr("MOD Desktop: parking engine on port %d for %u ms", engine->portBaseNum, keepAliveMs);
+            engine->parkDeadline = d_gettime_ms() + keepAliveMs;
+            engine->next = pool.parked;
+            pool.parked = engine;
+
+            if (! pool.isThreadRunning())
+                pool.startThread();
+            return;
+        }
+
+        delete engine;
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    const Mutex& getLock() const noexcept
+    {
+        return mutex;
+    }
+
+    // port base number in use, or negative error code
+    int getPortBaseNum() const noexcept
+    {
+        return portBaseNum;
+    }
+
+    bool isShared() const noexcept
+    {
+        return shared;
+    }
+
+    uint getPeriodSize() const noexcept
+    {
+        return periodSize;
+    }
+
+    // NOTE takes effect on the next jackd start
+    void setPeriodSize(const uint size) noexcept
+    {
+        periodSize = size;
+    }
+
+    uint getSampleRate() const noexcept
+    {
+        return sampleRate;
+    }
+
+    // NOTE takes effect on the next jackd start
+    void setSampleRate(const uint rate) noexcept
+    {
+        sampleRate = rate;
+    }
+
+    uint getNumChannels() const noexcept
+    {
+        return numChannels;
+    }
+
+    // NOTE takes effect on the next jackd start
+    void setNumChannels(const uint channels) noexcept
+    {
+        numChannels = channels;
+    }
+
+    bool isInProcess() const noexcept
+    {
+        return inProcess;
+    }
+
+    // NOTE takes effect on the next jackd start, falls back to a separate process if not possible
+    void setInProcess(const bool enabled) noexcept
+    {
+        inProcess = enabled;
+    }
+
+    MultiClientSupport getMultiClientSupport() const noexcept
+    {
+        return multiClient;
+    }
+
+    // set by client 0 after syncing with the server side
+    void setServerFeatures(const uint32_t features) noexcept
+    {
+        multiClient = (features & SharedMemory::kFeatureMultiClient) != 0 ? kMultiClientSupported
+                                                                          : kMultiClientUnsupported;
+        reattach = (features & SharedMemory::kFeatureReattach) != 0;
+    }
+
+    ChildProcess& getJackd() noexcept
+    {
+        return jackd;
+    }
+
+    // server running inside the plugin process, if in use
+    InProcessServer* getInProcessServer() noexcept
+    {
+        return server.isRunning() ? &server : nullptr;
+    }
+
+    bool isJackdRunning()
+    {
+        return server.isRunning() || jackd.isRunning();
+    }
+
+    bool isModUIRunning()
+    {
+        return mod_ui.isRunning();
+    }
+
+   #ifndef DISTRHO_OS_WINDOWS
+    // notify pipe of a starting mod-ui, written to once its web server is up, see ChildProcess::takeNotifyFd()
+    int takeModUINotifyFd() noexcept
+    {
+        return mod_ui.takeNotifyFd();
+    }
+   #endif
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    // keep jackd running, starting it if needed
+    Status runJackd()
+    {
+        if (isJackdRunning())
+        {
+            startingJackd = false;
+            return kStatusRunning;
+        }
+
+        if (startingJackd)
+        {
+            d_stderr("MOD Desktop: Failed to get jackd to run");
+            startingJackd = false;
+            portBaseNum = -kErrorJackdExecFailed;
+            return kStatusFailed;
+        }
+
+        const String appDir(getAppDir());
+        const String jackdStr(appDir + DISTRHO_OS_SEP_STR "jackd" APP_EXT);
+        const String jacksessionStr(appDir + DISTRHO_OS_SEP_STR "jack" DISTRHO_OS_SEP_STR "jack-session.conf");
+        const String servernameStr("mod-desktop-" + String(portBaseNum));
+        const String sampleRateStr(sampleRate);
+        const String periodSizeStr(periodSize);
+        const String shmportStr(portBaseNum);
+
+        // in-process server is ready as soon as started, no need to wait for the next Runner call
+        if (inProcess)
+        {
+            if (server.start(appDir, servernameStr, jacksessionStr, sampleRate, periodSize, portBaseNum,
+                             kPortNumOffset + portBaseNum * 3))
+            {
+                d_stderr("MOD Desktop: in-process jackd ok");
+                return kStatusRunning;
+            }
+
+            d_stderr("MOD Desktop: Failed to start jackd in-process, using a separate process");
+            inProcess = false;
+        }
+
+        const char* const jackd_args[] = {
+            jackdStr.buffer(),
+            "-R",
+            "-S",
+            "-n", servernameStr.buffer(),
+            "-C", jacksessionStr.buffer(),
+            "-d", "mod-desktop",
+            "-r", sampleRateStr.buffer(),
+            "-p", periodSizeStr.buffer(),
+            "-s", shmportStr,
+            nullptr
+        };
+
+        startingJackd = true;
+        if (jackd.start(jackd_args, envp))
+        {
+            d_stderr("MOD Desktop: jackd exec ok");
+           #ifdef DISTRHO_OS_WINDOWS
+            registry.setServerPid(GetProcessId(jackd.getProcessHandle()));
+           #else
+            registry.setServerPid(jackd.getPid());
+           #endif
+            return kStatusStarting;
+        }
+
+        d_stderr("MOD Desktop: Failed to start jackd");
+        portBaseNum = -kErrorJackdExecFailed;
+        return kStatusFailed;
+    }
+
+    // keep mod-ui running, starting it if needed
+    Status runModUI()
+    {
+        if (mod_ui.isRunning())
+        {
+            if (startingModUI)
+            {
+                d_stderr("MOD Desktop: Runner setup ok");
+                startingModUI = false;
+            }
+            return kStatusRunning;
+        }
+
+        if (startingModUI)
+        {
+            d_stderr("MOD Desktop: Failed to get mod-ui to run");
+            startingModUI = false;
+            portBaseNum = -kErrorModUiExecFailed;
+            return kStatusFailed;
+        }
+
+        const String appDir(getAppDir());
+        const String moduiStr(appDir + DISTRHO_OS_SEP_STR "mod-ui" APP_EXT);
+
+        const char* const mod_ui_args[] = {
+            moduiStr.buffer(),
+            nullptr
+        };
+
+        startingModUI = true;
+       #ifdef DISTRHO_OS_WINDOWS
+        if (mod_ui.start(mod_ui_args, envp))
+       #else
+        if (mod_ui.start(mod_ui_args, envp, true))
+       #endif
+        {
+            d_stderr("MOD Desktop: mod-ui exec ok");
+            return kStatusStarting;
+        }
+
+        d_stderr("MOD Desktop: Failed to start mod-ui");
+        portBaseNum = -kErrorModUiExecFailed;
+        return kStatusFailed;
+    }
+
+    // freeze jackd and mod-ui, so an idle engine uses no CPU at all
+    // NOTE in-process servers only run when posted to, so they have nothing to freeze
+    void hibernate()
+    {
+        if (hibernating || server.isRunning())
+            return;
+
+        d_stderr("MOD Desktop: hibernating engine on port %d", portBaseNum);
+        jackd.suspend();
+        mod_ui.suspend();
+        hibernating = true;
+    }
+
+    void wake()
+    {
+        if (! hibernating)
+            return;
+
+        d_stderr("MOD Desktop: waking up engine on port %d", portBaseNum);
+        jackd.resume();
+        mod_ui.resume();
+        hibernating = false;
+    }
+
+    // drop the graph left behind by the previous client of an adopted engine
+    // mod-ui holds that pedalboard, so it is stopped too and started again by the Runner of the new client
+    // NOTE called from that Runner without the engine lock, a dedicated engine has no one else touching mod-ui
+    void clearGraph()
+    {
+        DISTRHO_SAFE_ASSERT_RETURN(! hibernating,);
+
+        mod_ui.stop();
+        startingModUI = false;
+
+        if (! sendHostCommand(kPortNumOffset + portBaseNum * 3, "remove -1"))
+            d_stderr("MOD Desktop: failed to clear graph of engine on port %d", portBaseNum);
+    }
+
+    bool isHibernating() const noexcept
+    {
+        return hibernating;
+    }
+
+    void stopJackd()
+    {
+        server.stop();
+        jackd.stop();
+        startingJackd = false;
+    }
+
+private:
+    // all engines in use, plus parked ones which are stopped by the pool thread once their deadline passes
+    class Pool : public Thread
+    {
+    public:
+        Mutex mutex;
+        Engine* engines = nullptr;
+        Engine* parked = nullptr;
+
+        Pool()
+            : Thread("mod-desktop-engine-pool") {}
+
+        ~Pool() override
+        {
+            stopThread(-1);
+            deleteAll(parked);
+            parked = nullptr;
+        }
+
+    protected:
+        void run() override
+        {
+            while (! shouldThreadExit())
+            {
+                d_msleep(100);
+
+                Engine* expired = nullptr;
+
+                {
+                    const MutexLocker cml(mutex);
+                    const uint32_t now = d_gettime_ms();
+
+                    for (Engine** it = &parked; *it != nullptr;)
+                    {
+                        Engine* const engine = *it;
+
+                        if (static_cast<int32_t>(now - engine->parkDeadline) < 0)
+                        {
+                            it = &engine->next;
+                            continue;
+                        }
+
+                        *it = engine->next;
+                        engine->next = expired;
+                        expired = engine;
+                    }
+                }
+
+                // stopping processes takes a while, do it without blocking new instances
+                deleteAll(expired);
+            }
+        }
+
+    public:
+        // delete a list of engines, letting all their processes exit in parallel
+        static void deleteAll(Engine* const list)
+        {
+            for (Engine* engine = list; engine != nullptr; engine = engine->next)
+            {
+                d_stderr("MOD Desktop: stopping parked engine on port %d", engine->portBaseNum);
+                engine->jackd.terminate();
+                engine->mod_ui.terminate();
+            }
+
+            for (Engine* engine = list; engine != nullptr;)
+            {
+                Engine* const next = engine->next;
+                delete engine;
+                engine = next;
+            }
+        }
+    };
+
+    static Pool& getPool()
+    {
+        static Pool pool;
+        return pool;
+    }
+
+    InstanceRegistry registry;
+    InProcessServer server;
+    ChildProcess jackd;
+    ChildProcess mod_ui;
+    Mutex mutex;
+    int portBaseNum = 0;
+    uint periodSize;
+    uint numChannels = SharedMemory::kDefaultChannels;
+    uint sampleRate = 48000;
+    const bool shared;
+    uint32_t clients = 0;
+    uint32_t parkDeadline = 0;
+    bool startingJackd = false;
+    bool startingModUI = false;
+    bool reattach = false;
+    bool inProcess = false;
+    bool hibernating = false;
+    MultiClientSupport multiClient = kMultiClientUnknown;
+    Engine* next = nullptr;
+
+   #ifdef DISTRHO_OS_WINDOWS
+    const WCHAR* envp = nullptr;
+   #else
+    char* const* envp = nullptr;
+   #endif
+
+    Engine(const bool shared_, const uint periodSize_)
+        : periodSize(periodSize_),
+          shared(shared_)
+    {
+        const int availablePortNum = registry.claim();
+
+        if (availablePortNum == 0)
+        {
+            d_stderr("MOD Desktop: Failed to find available ports");
+            portBaseNum = -kErrorShmSetupFailed;
+            return;
+        }
+
+        envp = getEvironment(availablePortNum);
+
+        if (envp == nullptr)
+        {
+            d_stderr("MOD Desktop: Failed to init environment");
+            portBaseNum = -kErrorAppDirNotFound;
+            return;
+        }
+
+        portBaseNum = availablePortNum;
+    }
+
+    ~Engine()
+    {
+        server.stop();
+
+        // let both processes exit in parallel, instead of waiting for one before asking the other
+        jackd.terminate();
+        mod_ui.terminate();
+        jackd.wait();
+        mod_ui.wait();
+
+        if (envp != nullptr)
+        {
+           #ifndef DISTRHO_OS_WINDOWS
+            for (uint i = 0; envp[i] != nullptr; ++i)
+                std::free(envp[i]);
+           #endif
+
+            delete[] envp;
+        }
+    }
+
+    DISTRHO_DECLARE_NON_COPYABLE(Engine)
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -0,0 +1,441 @@
+// SPDX-FileCopyrightText: 2023-2024 MOD Audio UG
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#pragma once
+
+#include "DistrhoUtils.hpp"
+#include "extra/String.hpp"
+
+#include <cstdio>
+
+#ifdef DISTRHO_OS_WINDOWS
+# include <winsock2.h>
+# include <windows.h>
+#else
+# include <dlfcn.h>
+#endif
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+// jackd server running inside the plugin process, loaded from the bundled libjackserver through its control API.
+// The mod-desktop driver is opened with its "in-process" parameter set, which makes it skip its own processing thread.
+// Its cycles are then run directly from the plugin side through jack_mod_desktop_process(), see SharedMemory::post().
+// The process environment belongs to the host and is never touched, settings go through server and driver parameters.
+// Internal clients from the session file are loaded with their own arguments, mod-host getting its ports that way.
+// NOTE libjackserver keeps global state, so only a single server can run per process
+// NOTE libjackserver looks for its drivers in JACK_DRIVER_DIR or its built-in path, Engine uses a jackd process if not found
+
+class InProcessServer
+{
+public:
+    InProcessServer()
+    {
+    }
+
+    ~InProcessServer()
+    {
+        stop();
+    }
+
+    // load libjackserver and start a server with mod-host, as jackd would with the same arguments
+    bool start(const char* const appDir,
+               const char* const serverName,
+               const char* const sessionFile,
+               const uint sampleRate,
+               const uint periodSize,
+               const uint shmPort,
+               const uint hostPort)
+    {
+        DISTRHO_SAFE_ASSERT_RETURN(server == nullptr, false);
+
+        if (__atomic_exchange_n(&getInUse(), true, __ATOMIC_ACQ_REL))
+        {
+            d_stderr("InProcessServer::start() - another server is already running in this process");
+            return false;
+        }
+
+        claimed = true;
+
+        if (! load(appDir))
+            return fail_stop();
+
+        server = jackctl_server_create(nullptr, nullptr);
+        DISTRHO_SAFE_ASSERT_RETURN(server != nullptr, fail_stop());
+
+        jackctl_parameter_value value;
+
+        std::memset(&value, 0, sizeof(value));
+        std::strncpy(value.str, serverName, sizeof(value.str) - 1);
+        setParameter(jackctl_server_get_parameters(server), "name", value);
+
+        std::memset(&value, 0, sizeof(value));
+        value.b = false;
+        setParameter(jackctl_server_get_parameters(server), "realtime", value);
+
+        value.b = true;
+        setParameter(jackctl_server_get_parameters(server), "sync", value);
+
+        jackctl_driver_t* driver = nullptr;
+
+        for (const JSList* it = jackctl_server_get_drivers_list(server); it != nullptr; it = it->next)
+        {
+            if (std::strcmp(jackctl_driver_get_name(static_cast<jackctl_driver_t*>(it->data)), "mod-desktop") == 0)
+            {
+                driver = static_cast<jackctl_driver_t*>(it->data);
+                break;
+            }
+        }
+
+        DISTRHO_SAFE_ASSERT_RETURN(driver != nullptr, fail_stop());
+
+        const JSList* const driverParams = jackctl_driver_get_parameters(driver);
+
+        // older drivers always run their own thread, which is of no use here
+        value.b = true;
+        if (! setParameter(driverParams, "in-process", value))
+        {
+            d_stderr("InProcessServer::start() - mod-desktop driver does not support in-process mode");
+            return fail_stop();
+        }
+
+        value.ui = sampleRate;
+        setParameter(driverParams, 'r', value);
+
+        value.ui = periodSize;
+        setParameter(driverParams, 'p', value);
+
+        value.ui = shmPort;
+        setParameter(driverParams, 's', value);
+
+        DISTRHO_SAFE_ASSERT_RETURN(jackctl_server_open(server, driver), fail_stop());
+        opened = true;
+
+        DISTRHO_SAFE_ASSERT_RETURN(jackctl_server_start(server), fail_stop());
+        started = true;
+
+        if (! loadSessionFile(serverName, sessionFile, hostPort))
+            return fail_stop();
+
+        // the driver is loaded by now, get its processing entry point
+        if (! loadDriverProcess(appDir))
+            return fail_stop();
+
+        port = shmPort;
+        d_stderr("InProcessServer::start() - ok");
+        return true;
+    }
+
+    void stop()
+    {
+        if (server != nullptr)
+        {
+            if (started)
+                jackctl_server_stop(server);
+            if (opened)
+                jackctl_server_close(server);
+
+            jackctl_server_destroy(server);
+            server = nullptr;
+            started = opened = false;
+        }
+
+        driverProcess = nullptr;
+        port = 0;
+
+        if (driverLib != nullptr)
+        {
+            closeLibrary(driverLib);
+            driverLib = nullptr;
+        }
+
+        // NOTE libjackserver is kept loaded, its static state does not support being unloaded and loaded again
+        // releasing the in-use flag here also covers a failed start(), which always goes through fail_stop()
+        if (claimed)
+        {
+            __atomic_store_n(&getInUse(), false, __ATOMIC_RELEASE);
+            claimed = false;
+        }
+    }
+
+    bool isRunning() const noexcept
+    {
+        return driverProcess != nullptr;
+    }
+
+    // run the server side cycle inline, done for every post from the plugin side
+    static void process(void* const arg)
+    {
+        InProcessServer* const self = static_cast<InProcessServer*>(arg);
+
+        self->driverProcess(self->port);
+    }
+
+private:
+    // minimal subset of jack/control.h, we do not build against jack headers
+    struct jackctl_server_t;
+    struct jackctl_driver_t;
+    struct jackctl_parameter_t;
+
+    struct JSList {
+        void* data;
+        JSList* next;
+    };
+
+    union jackctl_parameter_value {
+        uint32_t ui;
+        int32_t i;
+        char c;
+        char str[128];
+        bool b;
+    };
+
+    typedef jackctl_server_t* (*jackctl_server_create_t)(bool (*)(const char*), void (*)(const char*));
+    typedef void (*jackctl_server_destroy_t)(jackctl_server_t*);
+    typedef bool (*jackctl_server_open_t)(jackctl_server_t*, jackctl_driver_t*);
+    typedef bool (*jackctl_server_start_t)(jackctl_server_t*);
+    typedef bool (*jackctl_server_stop_t)(jackctl_server_t*);
+    typedef bool (*jackctl_server_close_t)(jackctl_server_t*);
+    typedef const JSList* (*jackctl_server_get_drivers_list_t)(jackctl_server_t*);
+    typedef const JSList* (*jackctl_server_get_parameters_t)(jackctl_server_t*);
+    typedef const char* (*jackctl_driver_get_name_t)(jackctl_driver_t*);
+    typedef const JSList* (*jackctl_driver_get_parameters_t)(jackctl_driver_t*);
+    typedef const char* (*jackctl_parameter_get_name_t)(jackctl_parameter_t*);
+    typedef char (*jackctl_parameter_get_id_t)(jackctl_parameter_t*);
+    typedef bool (*jackctl_parameter_set_value_t)(jackctl_parameter_t*, const jackctl_parameter_value*);
+    typedef void (*jack_mod_desktop_process_t)(uint32_t);
+
+    // minimal subset of jack/jack.h and jack/intclient.h, for loading internal clients with arguments
+    struct jack_client_t;
+
+    enum {
+        JackNoStartServer = 0x01,
+        JackServerName = 0x04,
+        JackLoadName = 0x08,
+        JackLoadInit = 0x10
+    };
+
+    typedef jack_client_t* (*jack_client_open_t)(const char*, int, int*, ...);
+    typedef int (*jack_client_close_t)(jack_client_t*);
+    typedef uint64_t (*jack_internal_client_load_t)(jack_client_t*, const char*, int, int*, ...);
+
+    jackctl_server_create_t jackctl_server_create = nullptr;
+    jackctl_server_destroy_t jackctl_server_destroy = nullptr;
+    jackctl_server_open_t jackctl_server_open = nullptr;
+    jackctl_server_start_t jackctl_server_start = nullptr;
+    jackctl_server_stop_t jackctl_server_stop = nullptr;
+    jackctl_server_close_t jackctl_server_close = nullptr;
+    jackctl_server_get_drivers_list_t jackctl_server_get_drivers_list = nullptr;
+    jackctl_server_get_parameters_t jackctl_server_get_parameters = nullptr;
+    jackctl_driver_get_name_t jackctl_driver_get_name = nullptr;
+    jackctl_driver_get_parameters_t jackctl_driver_get_parameters = nullptr;
+    jackctl_parameter_get_name_t jackctl_parameter_get_name = nullptr;
+    jackctl_parameter_get_id_t jackctl_parameter_get_id = nullptr;
+    jackctl_parameter_set_value_t jackctl_parameter_set_value = nullptr;
+    jack_client_open_t jack_client_open = nullptr;
+    jack_client_close_t jack_client_close = nullptr;
+    jack_internal_client_load_t jack_internal_client_load = nullptr;
+    jack_mod_desktop_process_t driverProcess = nullptr;
+
+    void* driverLib = nullptr;
+    jackctl_server_t* server = nullptr;
+    uint32_t port = 0;
+    bool claimed = false;
+    bool opened = false;
+    bool started = false;
+
+    static bool& getInUse()
+    {
+        static bool inUse = false;
+        return inUse;
+    }
+
+    // libjackserver is opened once and then kept loaded for the lifetime of the process, see stop()
+    // NOTE only called with the in-use flag claimed, which also keeps the handle from being opened twice
+    bool load(const char* const appDir)
+    {
+        static void* lib = nullptr;
+
+        if (lib == nullptr)
+        {
+           #if defined(DISTRHO_OS_WINDOWS)
+            const String filename(String(appDir) + "\\libjackserver64.dll");
+           #elif defined(DISTRHO_OS_MAC)
+            const String filename(String(appDir) + "/libjackserver.0.dylib");
+           #else
+            const String filename(String(appDir) + "/libjackserver.so.0");
+           #endif
+
+            lib = openLibrary(filename);
+
+            if (lib == nullptr)
+            {
+                d_stderr("InProcessServer::load() - failed to open %s", filename.buffer());
+                return false;
+            }
+        }
+
+        #define JACKCTL_SYMBOL(NAME)                                                      \
+            NAME = reinterpret_cast<NAME##_t>(getLibrarySymbol(lib, #NAME));              \
+            DISTRHO_CUSTOM_SAFE_ASSERT_RETURN(#NAME, NAME != nullptr, false);
+
+        JACKCTL_SYMBOL(jackctl_server_create)
+        JACKCTL_SYMBOL(jackctl_server_destroy)
+        JACKCTL_SYMBOL(jackctl_server_open)
+        JACKCTL_SYMBOL(jackctl_server_start)
+        JACKCTL_SYMBOL(jackctl_server_stop)
+        JACKCTL_SYMBOL(jackctl_server_close)
+        JACKCTL_SYMBOL(jackctl_server_get_drivers_list)
+        JACKCTL_SYMBOL(jackctl_server_get_parameters)
+        JACKCTL_SYMBOL(jackctl_driver_get_name)
+        JACKCTL_SYMBOL(jackctl_driver_get_parameters)
+        JACKCTL_SYMBOL(jackctl_parameter_get_name)
+        JACKCTL_SYMBOL(jackctl_parameter_get_id)
+        JACKCTL_SYMBOL(jackctl_parameter_set_value)
+        JACKCTL_SYMBOL(jack_client_open)
+        JACKCTL_SYMBOL(jack_client_close)
+        JACKCTL_SYMBOL(jack_internal_client_load)
+
+        #undef JACKCTL_SYMBOL
+
+        return true;
+    }
+
+    // take an extra reference on the driver library loaded by libjackserver, to find its processing function
+    bool loadDriverProcess(const char* const appDir)
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        const String filename(String(appDir) + "\\jack\\jack_mod-desktop.dll");
+       #else
+        const String filename(String(appDir) + "/jack/jack_mod-desktop.so");
+       #endif
+
+        driverLib = openLibrary(filename);
+        DISTRHO_SAFE_ASSERT_RETURN(driverLib != nullptr, false);
+
+        driverProcess = reinterpret_cast<jack_mod_desktop_process_t>(getLibrarySymbol(driverLib, "jack_mod_desktop_process"));
+        DISTRHO_SAFE_ASSERT_RETURN(driverProcess != nullptr, false);
+
+        return true;
+    }
+
+    bool setParameter(const JSList* params, const char* const name, const jackctl_parameter_value& value)
+    {
+        for (; params != nullptr; params = params->next)
+        {
+            jackctl_parameter_t* const param = static_cast<jackctl_parameter_t*>(params->data);
+
+            if (std::strcmp(jackctl_parameter_get_name(param), name) == 0)
+                return jackctl_parameter_set_value(param, &value);
+        }
+
+        return false;
+    }
+
+    bool setParameter(const JSList* params, const char id, const jackctl_parameter_value& value)
+    {
+        for (; params != nullptr; params = params->next)
+        {
+            jackctl_parameter_t* const param = static_cast<jackctl_parameter_t*>(params->data);
+
+            if (jackctl_parameter_get_id(param) == id)
+                return jackctl_parameter_set_value(param, &value);
+        }
+
+        return false;
+    }
+
+    bool fail_stop()
+    {
+        stop();
+        return false;
+    }
+
+    // load the internal clients listed in a jackd session file, the only command it uses
+    // mod-host would read its ports from the environment otherwise, so they are given as arguments
+    bool loadSessionFile(const char* const serverName, const char* const sessionFile, const uint hostPort)
+    {
+        std::FILE* const file = std::fopen(sessionFile, "r");
+
+        if (file == nullptr)
+        {
+            d_stderr("InProcessServer::loadSessionFile() - failed to open %s", sessionFile);
+            return false;
+        }
+
+        int status = 0;
+        jack_client_t* const client = jack_client_open("mod-desktop-session", JackNoStartServer|JackServerName,
+                                                       &status, serverName);
+
+        if (client == nullptr)
+        {
+            d_stderr("InProcessServer::loadSessionFile() - failed to connect to server, status %d", status);
+            std::fclose(file);
+            return false;
+        }
+
+        bool ok = true;
+        char line[256];
+
+        while (ok && std::fgets(line, sizeof(line), file) != nullptr)
+        {
+            char name[64] = {};
+            char soname[64] = {};
+            int argsOffset = 0;
+
+            if (std::sscanf(line, "l %63s %63s %n", name, soname, &argsOffset) != 2)
+                continue;
+
+            String args(line + argsOffset);
+            args.replace('\r', ' ').replace('\n', ' ');
+
+            if (std::strcmp(name, "mod-host") == 0)
+                args += String(" -p ") + String(hostPort) + String(" -f ") + String(hostPort + 1);
+
+            jack_internal_client_load(client, name, JackLoadName|JackLoadInit, &status, soname, args.buffer());
+
+            if (status != 0)
+            {
+                d_stderr("InProcessServer::loadSessionFile() - failed to load %s, status %d", name, status);
+                ok = false;
+            }
+        }
+
+        jack_client_close(client);
+        std::fclose(file);
+        return ok;
+    }
+
+    static void* openLibrary(const char* const filename)
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        return static_cast<void*>(LoadLibraryA(filename));
+       #else
+        return dlopen(filename, RTLD_NOW|RTLD_LOCAL);
+       #endif
+    }
+
+    static void* getLibrarySymbol(void* const lib, const char* const symbol)
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(lib), symbol));
+       #else
+        return dlsym(lib, symbol);
+       #endif
+    }
+
+    static void closeLibrary(void* const lib)
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        FreeLibrary(static_cast<HMODULE>(lib));
+       #else
+        dlclose(lib);
+       #endif
+    }
+
+    DISTRHO_DECLARE_NON_COPYABLE(InProcessServer)
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -0,0 +1,310 @@
+// SPDX-FileCopyrightText: 2023-2024 MOD Audio UG
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#pragma once
+
+#include "DistrhoPluginInfo.h"
+#include "SharedMemory.hpp"
+#include "utils.hpp"
+
+#ifdef DISTRHO_OS_WINDOWS
+# include <winsock2.h>
+# include <windows.h>
+#else
+# include <cerrno>
+# include <fcntl.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+// System-wide table of port base numbers in use, shared between all plugin instances of all processes.
+// Each slot stores the pid of its owner process and of the jackd it started.
+// On Linux owners also hold a lock on their slot byte, which tells if they are alive across pid namespaces.
+// Slots of dead owners are reclaimed together with their shm segment, but only once nothing uses them anymore,
+// as jackd and mod-ui can outlive a crashed owner.
+
+class InstanceRegistry
+{
+public:
+    static constexpr const uint kMaxInstances = 998;
+
+    InstanceRegistry()
+    {
+    }
+
+    ~InstanceRegistry()
+    {
+        release();
+        close();
+    }
+
+    // claim the lowest available port base number, returns 0 on failure
+    uint claim()
+    {
+        DISTRHO_SAFE_ASSERT_RETURN(port == 0, port);
+
+        if (data == nullptr && ! open())
+            return 0;
+
+        const uint32_t pid = getCurrentPid();
+
+        for (uint i = 0; i < kMaxInstances; ++i)
+        {
+            uint32_t owner = __atomic_load_n(&data->slots[i].owner, __ATOMIC_ACQUIRE);
+
+            if (owner == pid || (owner != 0 && isOwnerAlive(i, owner)))
+                continue;
+
+            if (! __atomic_compare_exchange_n(&data->slots[i].owner, &owner, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                continue;
+
+            // a live owner the checks above could not see still holds its lock
+            if (! lockSlot(i))
+            {
+                __atomic_store_n(&data->slots[i].owner, owner, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            const uint portBaseNum = i + 1;
+
+            // the slot is ours now, anything left in it belongs to a dead owner
+            if (owner != 0)
+            {
+                // orphaned processes would collide with a new jackd on server name and ports, leave them be
+                if (isSlotInUse(portBaseNum, __atomic_load_n(&data->slots[i].server, __ATOMIC_ACQUIRE)))
+                {
+                    d_stderr("InstanceRegistry::claim() - port %u from dead process %u still in use", portBaseNum, owner);
+                    unlockSlot(i);
+                    __atomic_store_n(&data->slots[i].owner, owner, __ATOMIC_RELEASE);
+                    continue;
+                }
+
+                d_stderr("InstanceRegistry::claim() - reclaiming port %u from dead process %u", portBaseNum, owner);
+                SharedMemory::removeStale(portBaseNum);
+            }
+
+            __atomic_store_n(&data->slots[i].server, 0, __ATOMIC_RELEASE);
+
+            // segment might be in use by an instance from before the registry existed
+            if (! SharedMemory::canInit(portBaseNum))
+            {
+                unlockSlot(i);
+                __atomic_store_n(&data->slots[i].owner, 0, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            port = portBaseNum;
+            return port;
+        }
+
+        d_stderr("InstanceRegistry::claim() - all ports in use");
+        return 0;
+    }
+
+    void release()
+    {
+        if (port == 0)
+            return;
+
+        uint32_t pid = getCurrentPid();
+        __atomic_store_n(&data->slots[port - 1].server, 0, __ATOMIC_RELEASE);
+        __atomic_compare_exchange_n(&data->slots[port - 1].owner, &pid, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        unlockSlot(port - 1);
+        port = 0;
+    }
+
+    // remember the jackd process started for the claimed port, so it is not reclaimed while jackd is still alive
+    void setServerPid(const uint32_t pid)
+    {
+        DISTRHO_SAFE_ASSERT_RETURN(port != 0,);
+
+        __atomic_store_n(&data->slots[port - 1].server, pid, __ATOMIC_RELEASE);
+    }
+
+private:
+    struct Slot {
+        uint32_t owner;
+        uint32_t server;
+    };
+
+    struct Data {
+        Slot slots[kMaxInstances];
+    };
+
+    static constexpr const size_t kDataSize = sizeof(Data);
+
+   #ifdef DISTRHO_OS_WINDOWS
+    HANDLE shm = nullptr;
+   #else
+    int shmfd = -1;
+   #endif
+
+    Data* data = nullptr;
+    uint port = 0;
+
+    // NOTE a new segment is zero-filled, which means all slots are free
+    bool open()
+    {
+        void* ptr;
+
+      #ifdef DISTRHO_OS_WINDOWS
+        shm = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE|SEC_COMMIT, 0,
+                                 static_cast<DWORD>(kDataSize), "Local\\mod-desktop-registry-3");
+        DISTRHO_SAFE_ASSERT_RETURN(shm != nullptr, false);
+
+        ptr = MapViewOfFile(shm, FILE_MAP_ALL_ACCESS, 0, 0, kDataSize);
+        DISTRHO_SAFE_ASSERT_RETURN(ptr != nullptr, fail_close());
+      #else
+        shmfd = shm_open("/mod-desktop-registry-3", O_CREAT|O_RDWR, 0666);
+        DISTRHO_CUSTOM_SAFE_ASSERT_RETURN(std::strerror(errno), shmfd >= 0, false);
+
+        // a no-op if the segment was already created by someone else
+        DISTRHO_CUSTOM_SAFE_ASSERT_RETURN(std::strerror(errno), ftruncate(shmfd, static_cast<off_t>(kDataSize)) == 0, fail_close());
+
+        ptr = mmap(nullptr, kDataSize, PROT_READ|PROT_WRITE, MAP_SHARED, shmfd, 0);
+        DISTRHO_CUSTOM_SAFE_ASSERT_RETURN(std::strerror(errno), ptr != nullptr, fail_close());
+        DISTRHO_CUSTOM_SAFE_ASSERT_RETURN(std::strerror(errno), ptr != MAP_FAILED, fail_close());
+      #endif
+
+        data = static_cast<Data*>(ptr);
+        return true;
+    }
+
+    void close()
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+            data = nullptr;
+        }
+
+        if (shm != nullptr)
+        {
+            CloseHandle(shm);
+            shm = nullptr;
+        }
+       #else
+        if (data != nullptr)
+        {
+            munmap(data, kDataSize);
+            data = nullptr;
+        }
+
+        if (shmfd >= 0)
+        {
+            ::close(shmfd);
+            shmfd = -1;
+        }
+       #endif
+    }
+
+    bool fail_close()
+    {
+        close();
+        return false;
+    }
+
+    static uint32_t getCurrentPid()
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        return GetCurrentProcessId();
+       #else
+        return static_cast<uint32_t>(getpid());
+       #endif
+    }
+
+    // NOTE on Linux the slot lock belongs to our registry fd, so slots of other instances in this process show up too
+    bool isOwnerAlive(const uint slot, const uint32_t owner) const
+    {
+       #ifdef F_OFD_GETLK
+        struct flock lock = {};
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        lock.l_start = static_cast<off_t>(slot);
+        lock.l_len = 1;
+
+        if (fcntl(shmfd, F_OFD_GETLK, &lock) == 0)
+            return lock.l_type != F_UNLCK;
+       #else
+        (void)slot;
+       #endif
+
+        return isProcessAlive(owner);
+    }
+
+    // the lock goes away with the process, no matter how it exits
+    bool lockSlot(const uint slot)
+    {
+       #ifdef F_OFD_SETLK
+        struct flock lock = {};
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        lock.l_start = static_cast<off_t>(slot);
+        lock.l_len = 1;
+
+        // older kernels without open file description locks fall back to pid checks
+        if (fcntl(shmfd, F_OFD_SETLK, &lock) != 0)
+            return errno == EINVAL;
+       #else
+        (void)slot;
+       #endif
+
+        return true;
+    }
+
+    void unlockSlot(const uint slot)
+    {
+       #ifdef F_OFD_SETLK
+        struct flock lock = {};
+        lock.l_type = F_UNLCK;
+        lock.l_whence = SEEK_SET;
+        lock.l_start = static_cast<off_t>(slot);
+        lock.l_len = 1;
+
+        fcntl(shmfd, F_OFD_SETLK, &lock);
+       #else
+        (void)slot;
+       #endif
+    }
+
+    // NOTE a reused pid keeps the slot taken until that process exits too
+    static bool isProcessAlive(const uint32_t pid)
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        const HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+
+        if (process == nullptr)
+            return GetLastError() == ERROR_ACCESS_DENIED;
+
+        const bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+        CloseHandle(process);
+        return alive;
+       #else
+        return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+       #endif
+    }
+
+    // jackd of a dead owner still running, or mod-host and mod-ui still listening on the slot ports
+    static bool isSlotInUse(const uint portBaseNum, const uint32_t serverPid)
+    {
+        if (serverPid != 0 && isProcessAlive(serverPid))
+            return true;
+
+        for (uint i = 0; i < 3; ++i)
+            if (isPortListening(kPortNumOffset + portBaseNum * 3 + i))
+                return true;
+
+        return false;
+    }
+
+    DISTRHO_DECLARE_NON_COPYABLE(InstanceRegistry)
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
@@ -5,9 +5,13 @@
 
 #include "DistrhoUtils.hpp"
 
+#include <atomic>
+
 #ifndef DISTRHO_OS_WINDOWS
 # include <cerrno>
+# include <ctime>
 # include <fcntl.h>
+# include <signal.h>
 # include <sys/mman.h>
 # ifdef DISTRHO_OS_MAC
 extern "C" {
@@ -15,6 +19,7 @@ int __ulock_wait(uint32_t operation, void* addr, uint64_t value, uint32_t timeou
 int __ulock_wake(uint32_t operation, void* addr, uint64_t value);
 }
 # else
+#  include <poll.h>
 #  include <syscall.h>
 #  include <sys/time.h>
 #  include <linux/futex.h>
@@ -28,9 +33,128 @@ START_NAMESPACE_DISTRHO
 class SharedMemory
 {
 public:
+    static constexpr const uint32_t kMagic = 1337;
+    static constexpr const uint32_t kProtocolVersion = 2;
+
+    // stop signal for servers without protocol versioning
+    static constexpr const uint32_t kLegacyMagicStop = 7331;
+
+    static constexpr const uint32_t kMinPeriodSize = 16;
+    static constexpr const uint32_t kMaxPeriodSize = 256;
+    static constexpr const uint32_t kDefaultPeriodSize = 128;
+    static constexpr const uint32_t kRingSize = 16;
+    static constexpr const uint32_t kMaxChannels = 16;
+    static constexpr const uint32_t kMaxClients = 16;
+    static constexpr const uint32_t kDefaultChannels = 2;
+
+    // maximum time to wait for the server side outside of realtime processing
+    static constexpr const uint64_t kDefaultTimeoutNs = 1000000000ULL;
+
+    // maximum time to wait for a freshly started server side to come up and reply to the handshake
+    static constexpr const uint64_t kStartupTimeoutNs = 10000000000ULL;
+
+    // granularity of sync() waits, to notice a dead server side or abortSync() early
+    static constexpr const uint64_t kSyncSliceNs = 50000000ULL;
+
+    // time without progress on late periods after which the bridge is considered out of sync
+    static constexpr const uint64_t kStallTimeoutNs = 50000000ULL;
+
+    // maximum time to busy-wait for the server side, before going to sleep
+    static constexpr const uint64_t kMaxSpinTimeNs = 100000;
+
+    enum WaitPolicy {
+        // always sleep in the kernel until the server side is done
+        kWaitPolicySleep,
+        // busy-wait for a budget learned from recent server turnaround times, then sleep
+        kWaitPolicyAdaptiveSpin
+    };
+
+    // optional protocol features, the ones in use are negotiated during sync()
+    enum Features {
+        // period size other than the default 128 frames
+        kFeaturePeriodSize = 1 << 0,
+        // channel count other than stereo
+        kFeatureChannelCount = 1 << 1,
+        // MIDI events bigger than 4 bytes (not implemented yet)
+        kFeatureMidiPool = 1 << 2,
+        // batched and pipelined processing through the period ring
+        kFeaturePipelining = 1 << 3,
+        // server side timestamps in Timings
+        kFeatureTimings = 1 << 4,
+        // extra clients attached through their own shm segments, see init()
+        kFeatureMultiClient = 1 << 5,
+        // server side keeps running after kStateStopped, waiting for a new segment with the same name
+        kFeatureReattach = 1 << 6,
+        // sample rate other than 48kHz, plus server side requests for a specific one
+        kFeatureSampleRate = 1 << 7,
+    };
+
+    static constexpr const uint32_t kSupportedFeatures = kFeaturePeriodSize
+                                                       | kFeatureChannelCount
+                                                       | kFeaturePipelining
+                                                       | kFeatureTimings
+                                                       | kFeatureMultiClient
+                                                       | kFeatureReattach
+                                                       | kFeatureSampleRate;
+
+    enum State {
+        // waiting for the handshake
+        kStateIdle,
+        // handshake done, server side is processing
+        kStateRunning,
+        // plugin side requested to stop, server side finishes queued periods
+        kStateDraining,
+        // server side acknowledged the stop request, no longer touching shared memory
+        kStateStopped
+    };
+
+    // protocol negotiation and state, every change is followed by a post from the writer side
+    struct Protocol {
+        // written by the plugin side
+        uint32_t pluginFeatures;
+        // written by the server side during the handshake
+        uint32_t serverVersion;
+        uint32_t serverFeatures;
+        // see State enum
+        uint32_t state;
+        // written by the server side at any time, non-zero if the loaded pedalboard needs a specific sample rate
+        uint32_t requiredSampleRate;
+    };
+
+    // audio and MIDI data for a single period, in-place processed by the server side
+    // audio channels are laid out one after the other, using the negotiated period size as stride
+    // NOTE servers without versioning only know about the first 2 channels
+    struct Period {
+        uint16_t midiEventCount;
+        uint16_t midiFrames[511];
+        uint8_t midiData[511 * 4];
+        uint8_t padding[4];
+        float audio[kMaxPeriodSize * kMaxChannels];
+    };
+
+    // single-producer single-consumer ring of periods, allowing to process many of them per server wake-up
+    // head and tail are free-running counters, head written only by the plugin and tail only by the server
+    // server side sets tail to head during the handshake
+    struct Ring {
+        alignas(64) uint32_t head;
+        alignas(64) uint32_t tail;
+        alignas(64) Period periods[kRingSize];
+    };
+
+    // timestamps of the last processing cycle, using the system-wide monotonic clock in nanoseconds
+    struct Timings {
+        // written by the plugin side
+        uint64_t pluginPost;
+        // written by the server side
+        uint64_t serverWake;
+        uint64_t serverDone;
+        // written by the plugin side
+        uint64_t pluginResume;
+    };
+
     struct Data {
         uint32_t magic;
-        int32_t padding1;
+        uint32_t version;
        #ifdef DISTRHO_OS_WINDOWS
         HANDLE sem1;
         HANDLE sem2;
@@ -38,15 +162,19 @@ public:
         int32_t sem1;
         int32_t sem2;
        #endif
-        uint16_t midiEventCount;
-        uint16_t midiFrames[511];
-        uint8_t midiData[511 * 4];
-        uint8_t padding2[4];
-        float audio[];
+        // NOTE layout up to here matches the original single-period protocol, version 0 and 1
+        Period period;
+        Protocol protocol;
+        // written by the plugin side before starting the server
+        uint32_t periodSize;
+        uint32_t numChannels;
+        Timings timings;
+        Ring ring;
     }* data = nullptr;
 
    #ifndef DISTRHO_OS_WINDOWS
     uint port = 0;
+    uint client = 0;
    #endif
 
     SharedMemory()
@@ -90,7 +218,27 @@ public:
         return false;
     }
 
-    bool init(const uint portBaseNum)
+    // remove the segment left behind by a crashed instance
+    // NOTE on Windows it is gone together with the last process using it
+    static void removeStale(const uint portBaseNum)
+    {
+       #ifndef DISTRHO_OS_WINDOWS
+        char shmName[32] = {};
+
+        for (uint c = 0; c < kMaxClients; ++c)
+        {
+            getShmName(shmName, portBaseNum, c);
+            shm_unlink(shmName);
+        }
+       #else
+        // unused
+        (void)portBaseNum;
+       #endif
+    }
+
+    // client 0 is the one the server side is started with,
+    // others can be attached later on if the server side supports it (see kFeatureMultiClient)
+    bool init(const uint portBaseNum, const uint clientNum = 0)
     {
         void* ptr;
         char shmName[32] = {};
@@ -100,7 +248,7 @@ public:
         sa.nLength = sizeof(sa);
         sa.bInheritHandle = TRUE;
 
-        std::snprintf(shmName, 31, "Local\\mod-desktop-shm-%d", portBaseNum);
+        getShmName(shmName, portBaseNum, clientNum);
 
         shm = CreateFileMappingA(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE|SEC_COMMIT, 0, static_cast<DWORD>(kDataSize), shmName);
         DISTRHO_SAFE_ASSERT_RETURN(shm != nullptr, false);
@@ -110,7 +258,7 @@ public:
 
         VirtualLock(ptr, kDataSize);
       #else
-        std::snprintf(shmName, 31, "/mod-desktop-shm-%d", portBaseNum);
+        getShmName(shmName, portBaseNum, clientNum);
 
         shmfd = shm_open(shmName, O_CREAT|O_EXCL|O_RDWR, 0666);
         DISTRHO_CUSTOM_SAFE_ASSERT_RETURN(std::strerror(errno), shmfd >= 0, false);
@@ -135,7 +283,16 @@ public:
         data = static_cast<Data*>(ptr);
 
         std::memset(data, 0, kDataSize);
-        data->magic = 1337;
+        data->magic = kMagic;
+        data->version = kProtocolVersion;
+        data->periodSize = periodSize;
+        data->numChannels = numChannels;
+        resetRing();
+        serverVersion = features = 0;
+        numXruns = 0;
+        numResyncs = 0;
+        synced = false;
+        syncAborted = false;
 
        #ifdef DISTRHO_OS_WINDOWS
         data->sem1 = CreateSemaphoreA(&sa, 0, 1, nullptr);
@@ -145,6 +302,7 @@ public:
         DISTRHO_SAFE_ASSERT_RETURN(data->sem2 != nullptr, fail_deinit());
        #else
         port = portBaseNum;
+        client = clientNum;
        #endif
 
         return true;
@@ -152,6 +310,10 @@ public:
 
     void deinit()
     {
+        resetRing();
+        clearPeer();
+        setInProcessServer(nullptr, nullptr);
+
        #ifdef DISTRHO_OS_WINDOWS
         if (data != nullptr)
         {
@@ -192,39 +354,352 @@ public:
         if (port != 0)
         {
             char shmName[32] = {};
-            std::snprintf(shmName, 31, "/mod-desktop-shm-%d", port);
+            getShmName(shmName, port, client);
             shm_unlink(shmName);
-            port = 0;
+            port = client = 0;
         }
        #endif
     }
 
     // ----------------------------------------------------------------------------------------------------------------
 
-    bool sync()
+    // protocol version of the server side, 0 if it does not support versioning
+    uint32_t getServerVersion() const noexcept
+    {
+        return serverVersion;
+    }
+
+    // whether a feature has been negotiated with the server side, valid after sync()
+    bool hasFeature(const Features feature) const noexcept
+    {
+        return (features & feature) != 0;
+    }
+
+    // all features negotiated with the server side, valid after sync()
+    uint32_t getFeatures() const noexcept
+    {
+        return features;
+    }
+
+    // sample rate the server side asks for, 0 if any rate is fine
+    uint32_t getRequiredSampleRate() const noexcept
+    {
+        if (! hasFeature(kFeatureSampleRate))
+            return 0;
+
+        return __atomic_load_n(&data->protocol.requiredSampleRate, __ATOMIC_RELAXED);
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    uint32_t getPeriodSize() const noexcept
+    {
+        return periodSize;
+    }
+
+    // NOTE must be called before starting the server side, takes effect on the next init()
+    void setPeriodSize(const uint32_t size) noexcept
+    {
+        DISTRHO_SAFE_ASSERT_UINT_RETURN(size >= kMinPeriodSize && size <= kMaxPeriodSize, size,);
+
+        periodSize = size;
+    }
+
+    // number of audio channels in each direction, also used for CV
+    uint32_t getNumChannels() const noexcept
+    {
+        return numChannels;
+    }
+
+    // NOTE must be called before starting the server side, takes effect on the next init()
+    void setNumChannels(const uint32_t channels) noexcept
+    {
+        DISTRHO_SAFE_ASSERT_UINT_RETURN(channels >= 1 && channels <= kMaxChannels, channels,);
+
+        numChannels = channels;
+    }
+
+    // number of audio channels actually processed by the server side, valid after sync()
+    uint32_t getNumActiveChannels() const noexcept
+    {
+        return hasFeature(kFeatureChannelCount) ? numChannels : std::min(numChannels, kDefaultChannels);
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    // get a timestamp from the system-wide monotonic clock, which the server side uses as well
+    static uint64_t getMonotonicTime() noexcept
+    {
+       #if defined(DISTRHO_OS_WINDOWS)
+        static LARGE_INTEGER frequency = {};
+        LARGE_INTEGER counter;
+
+        if (frequency.QuadPart == 0)
+            QueryPerformanceFrequency(&frequency);
+
+        QueryPerformanceCounter(&counter);
+        return static_cast<uint64_t>(counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+             + static_cast<uint64_t>(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+       #elif defined(DISTRHO_OS_MAC)
+        return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+       #else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+       #endif
+    }
+
+    // timestamps of the last processing cycle, valid after processPeriods() returns
+    // server side timestamps are 0 if not supported
+    const Timings& getTimings() const noexcept
+    {
+        return data->timings;
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    WaitPolicy getWaitPolicy() const noexcept
+    {
+        return waitPolicy;
+    }
+
+    // NOTE must not be called while processing
+    void setWaitPolicy(const WaitPolicy policy) noexcept
+    {
+        waitPolicy = policy;
+        spinBudget = 0;
+        turnaroundAverage = 0;
+    }
+
+    // number of waits that were resolved while busy-waiting
+    uint32_t getNumSpinWaits() const noexcept
+    {
+        return numSpinWaits.load(std::memory_order_relaxed);
+    }
+
+    // number of waits that had to sleep in the kernel
+    uint32_t getNumSleepWaits() const noexcept
+    {
+        return numSleepWaits.load(std::memory_order_relaxed);
+    }
+
+    // number of processing calls where the server side missed the deadline
+    uint32_t getNumXruns() const noexcept
+    {
+        return numXruns.load(std::memory_order_relaxed);
+    }
+
+    // number of times the bridge had to be synced again with an already running server side
+    uint32_t getNumResyncs() const noexcept
+    {
+        return numResyncs.load(std::memory_order_relaxed);
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    // set the server side process, so its death is noticed right away instead of waiting for a timeout
+   #ifdef DISTRHO_OS_WINDOWS
+    void setPeer(const HANDLE process)
+    {
+        clearPeer();
+
+        if (DuplicateHandle(GetCurrentProcess(), process, GetCurrentProcess(), &peerProcess,
+                            SYNCHRONIZE, FALSE, 0) == FALSE)
+            peerProcess = nullptr;
+    }
+   #else
+    // exitFd is the pidfd kept by ChildProcess, or -1 if not supported
+    // it is duplicated instead of opened again by pid, so both sides can close theirs whenever they need to
+    void setPeer(const pid_t pid, const int exitFd)
+    {
+        clearPeer();
+        peerPid = pid;
+
+        if (exitFd >= 0)
+            peerfd = fcntl(exitFd, F_DUPFD_CLOEXEC, 0);
+    }
+   #endif
+
+    void clearPeer()
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        if (peerProcess != nullptr)
+        {
+            CloseHandle(peerProcess);
+            peerProcess = nullptr;
+        }
+       #else
+        if (peerfd >= 0)
+        {
+            close(peerfd);
+            peerfd = -1;
+        }
+
+        peerPid = -1;
+       #endif
+    }
+
+    // run the server side cycle inline on every post, for servers in the same process without a thread of their own
+    // the server side still posts back as usual, so waits complete right away
+    void setInProcessServer(void (*const process)(void*), void* const arg) noexcept
+    {
+        inProcessServer = process;
+        inProcessServerArg = arg;
+    }
+
+    bool isInProcess() const noexcept
+    {
+        return inProcessServer != nullptr;
+    }
+
+    bool hasPeer() const noexcept
+    {
+       #ifdef DISTRHO_OS_WINDOWS
+        return peerProcess != nullptr;
+       #else
+        return peerPid > 0;
+       #endif
+    }
+
+    // whether the server side process is still alive, always true if unknown
+    bool isPeerAlive() const
+    {
+       #if defined(DISTRHO_OS_WINDOWS)
+        return peerProcess == nullptr || WaitForSingleObject(peerProcess, 0) == WAIT_TIMEOUT;
+       #else
+        if (peerPid <= 0)
+            return true;
+
+        // pidfd becomes readable once the process exits, even if not reaped yet
+        if (peerfd >= 0)
+        {
+            pollfd pfd = { peerfd, POLLIN, 0 };
+            return poll(&pfd, 1, 0) == 0;
+        }
+
+        // NOTE zombie processes count as alive until reaped
+        return kill(peerPid, 0) == 0 || errno != ESRCH;
+       #endif
+    }
+
+    // ----------------------------------------------------------------------------------------------------------------
+
+    // process a silent period while doing the protocol handshake
+    // servers without versioning just process the period, leaving the protocol fields untouched
+    // calling it again on a running server side resets the bridge state, see resync()
+    // the reply doubles as the readiness signal of a starting server side, so this can be called right after
+    // starting it with a longer timeout. gives up early if the server side process dies or abortSync() is called.
+    bool sync(const uint64_t timeoutNs = kDefaultTimeoutNs)
     {
         if (data == nullptr)
             return false;
 
-        data->midiEventCount = 0;
-        std::memset(data->audio, 0, sizeof(float) * 128 * 2);
+        drainRing();
+        startHandshake();
 
+        // NOTE a post done before the server side attaches stays pending until it first waits
         post();
-        return wait();
+
+        for (uint64_t waited = 0;; waited += kSyncSliceNs)
+        {
+            const uint64_t remaining = timeoutNs - waited;
+
+            if (wait(remaining < kSyncSliceNs ? remaining : kSyncSliceNs))
+                break;
+
+            if (remaining <= kSyncSliceNs || syncAborted.load(std::memory_order_acquire) || ! isPeerAlive())
+                return false;
+        }
+
+        finishHandshake();
+
+        d_stderr("SharedMemory::sync() - server version %u, features 0x%x", serverVersion, features);
+        return true;
+    }
+
+    // make a sync() in progress on another thread return early, used when stopping
+    void abortSync() noexcept
+    {
+        syncAborted.store(true, std::memory_order_release);
+    }
+
+    // non-blocking sync() meant for the audio thread, to recover from a lost wake-up without restarting the server.
+    // needs to be called repeatedly until it returns true, only possible with versioned servers.
+    bool resync()
+    {
+        DISTRHO_SAFE_ASSERT_RETURN(serverVersion >= kProtocolVersion, false);
+
+        const uint64_t now = getMonotonicTime();
+
+        if (resyncStartTime == 0)
+        {
+            // discard stale post
+            tryWait();
+            startHandshake();
+            post();
+            resyncStartTime = now;
+            return false;
+        }
+
+        // posts for old periods can still arrive, only the server state tells if the handshake is done
+        if (! tryWait() || __atomic_load_n(&data->protocol.state, __ATOMIC_ACQUIRE) != kStateRunning)
+        {
+            // wake up the server side again, in case it missed the first post
+            if (now - resyncStartTime > kDefaultTimeoutNs)
+            {
+                post();
+                resyncStartTime = now;
+            }
+            return false;
+        }
+
+        finishHandshake();
+        return true;
+    }
+
+    // server side stopped making progress while periods are late, the bridge needs a resync
+    bool isStalled() const noexcept
+    {
+        return isBefore(ringTail, ringDone) && getMonotonicTime() - lastProgressTime > kStallTimeoutNs;
     }
 
+    // ask the server side to stop, after it finishes any queued periods
     void stopWait()
     {
         if (data == nullptr)
             return;
 
-        data->magic = 7331;
-        data->midiEventCount = 0;
-        std::memset(data->audio, 0, sizeof(float) * 128 * 2);
+        drainRing();
+
+        if (serverVersion < kProtocolVersion)
+        {
+            data->magic = kLegacyMagicStop;
+            data->period.midiEventCount = 0;
+            std::memset(data->period.audio, 0, sizeof(data->period.audio));
+
+            post();
+            if (wait())
+                data->magic = kMagic;
+            return;
+        }
 
+        __atomic_store_n(&data->protocol.state, kStateDraining, __ATOMIC_RELEASE);
         post();
-        if (wait())
-            data->magic = 1337;
+
+        // waiting in slices, a server side that exited would keep us waiting for the full timeout otherwise
+        for (uint64_t waited = 0; __atomic_load_n(&data->protocol.state, __ATOMIC_ACQUIRE) != kStateStopped;)
+        {
+            if (wait(kSyncSliceNs))
+            {
+                waited = 0;
+                continue;
+            }
+
+            waited += kSyncSliceNs;
+
+            if (waited >= kDefaultTimeoutNs || ! isPeerAlive())
+                break;
+        }
     }
 
     bool process()
@@ -236,6 +711,121 @@ public:
         return wait();
     }
 
+    // ----------------------------------------------------------------------------------------------------------------
+    // batched and pipelined processing
+
+    // maximum number of periods that can be queued before calling processPeriods()
+    // also collects late periods that finished in the mean time, can be 0 if the server side is still busy with them
+    uint32_t getMaxPeriods()
+    {
+        if (ringEnabled)
+            setTail(__atomic_load_n(&data->ring.tail, __ATOMIC_ACQUIRE));
+        else if (ringTail != ringQueued && tryWait())
+            setTail(ringQueued);
+
+        // slots of late periods are only free once the server side is done with them
+        const uint32_t oldest = isBefore(ringTail, ringHead) ? ringTail : ringHead;
+
+        return (ringEnabled ? kRingSize : 1) - (ringQueued - oldest);
+    }
+
+    // get a period to write into, index is relative to the first not yet queued one
+    Period* getWritePeriod(const uint32_t index) const noexcept
+    {
+        if (! ringEnabled)
+            return &data->period;
+
+        return &data->ring.periods[(ringQueued + index) % kRingSize];
+    }
+
+    // queue a number of periods for processing with a single server wake-up
+    // returns once at most maxPending periods are still being processed, always 0 without ring support.
+    // periods not done by the deadline (in getMonotonicTime() units) are counted as an xrun and read back as silence.
+    // returns false if the server side is gone.
+    bool processPeriods(const uint32_t numPeriods, const uint32_t maxPending, const uint64_t deadline)
+    {
+        DISTRHO_SAFE_ASSERT_RETURN(numPeriods != 0 && numPeriods <= getMaxPeriods(), false);
+
+        const uint32_t pending = ringEnabled ? maxPending : 0;
+
+        ringQueued += numPeriods;
+
+        if (ringEnabled)
+            __atomic_store_n(&data->ring.head, ringQueued, __ATOMIC_RELEASE);
+
+        post();
+
+        // NOTE server side can post more than once per batch, we always check the tail position
+        for (;;)
+        {
+            if (ringEnabled)
+                setTail(__atomic_load_n(&data->ring.tail, __ATOMIC_ACQUIRE));
+
+            if (ringQueued - ringTail <= pending)
+                break;
+
+            const uint64_t now = getMonotonicTime();
+
+            if (now < deadline && wait(deadline - now))
+            {
+                if (! ringEnabled)
+                    setTail(ringQueued);
+                continue;
+            }
+
+            if (! isPeerAlive())
+            {
+                d_stderr("SharedMemory::processPeriods() - server side died");
+                return false;
+            }
+
+            numXruns.fetch_add(1, std::memory_order_relaxed);
+
+            if (isBefore(ringDone, ringQueued - pending))
+                ringDone = ringQueued - pending;
+            break;
+        }
+
+        if (isBefore(ringDone, ringTail))
+            ringDone = ringTail;
+
+        data->timings.pluginResume = getMonotonicTime();
+        return true;
+    }
+
+    // number of periods that have been processed or are late, and can be read back
+    uint32_t getNumReadablePeriods() const noexcept
+    {
+        return ringDone - ringHead;
+    }
+
+    // a period full of silence, for channels and periods the server side did not process
+    const Period* getSilentPeriod() const noexcept
+    {
+        return &silentPeriod;
+    }
+
+    // get a processed period to read from, index is relative to the first not yet released one
+    // late periods give a silent one
+    const Period* getReadPeriod(const uint32_t index) const noexcept
+    {
+        const uint32_t position = ringHead + index;
+
+        if (! isBefore(position, ringTail))
+            return &silentPeriod;
+
+        if (! ringEnabled)
+            return &data->period;
+
+        return &data->ring.periods[position % kRingSize];
+    }
+
+    // mark processed periods as read, so their slots can be reused
+    void releasePeriods(const uint32_t numPeriods) noexcept
+    {
+        ringHead += numPeriods;
+    }
+
 private:
     // ----------------------------------------------------------------------------------------------------------------
     // shared memory details
@@ -246,13 +836,148 @@ private:
     int shmfd = -1;
    #endif
 
-    static constexpr const size_t kDataSize = sizeof(Data) + sizeof(float) * 128 * 2;
+    static constexpr const size_t kDataSize = sizeof(Data);
+
+    uint32_t periodSize = kDefaultPeriodSize;
+    uint32_t numChannels = kDefaultChannels;
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // protocol details
+
+    uint32_t serverVersion = 0;
+    uint32_t features = 0;
+    bool synced = false;
+    std::atomic<bool> syncAborted { false };
+    uint64_t resyncStartTime = 0;
+
+    // reset the shared protocol state, the server side replies on its next wake-up
+    // NOTE server side sets ring tail to head during the handshake
+    void startHandshake()
+    {
+        data->protocol.pluginFeatures = kSupportedFeatures;
+        data->protocol.serverVersion = 0;
+        data->protocol.serverFeatures = 0;
+        data->protocol.requiredSampleRate = 0;
+        __atomic_store_n(&data->protocol.state, kStateIdle, __ATOMIC_RELEASE);
+
+        data->period.midiEventCount = 0;
+        std::memset(data->period.audio, 0, sizeof(data->period.audio));
+    }
+
+    // read back the server side reply, servers without versioning leave the protocol fields untouched
+    void finishHandshake()
+    {
+        if (__atomic_load_n(&data->protocol.state, __ATOMIC_ACQUIRE) == kStateRunning)
+        {
+            serverVersion = data->protocol.serverVersion;
+            features = data->protocol.serverFeatures & kSupportedFeatures;
+        }
+        else
+        {
+            serverVersion = features = 0;
+        }
+
+        resetRing();
+        ringEnabled = hasFeature(kFeaturePipelining);
+        ringHead = ringQueued = ringTail = ringDone = data->ring.head;
+        resyncStartTime = 0;
+        lastProgressTime = getMonotonicTime();
+
+        if (synced)
+            numResyncs.fetch_add(1, std::memory_order_relaxed);
+        synced = true;
+    }
+
+   #ifdef DISTRHO_OS_WINDOWS
+    HANDLE peerProcess = nullptr;
+   #else
+    pid_t peerPid = -1;
+    int peerfd = -1;
+   #endif
+
+    void (*inProcessServer)(void*) = nullptr;
+    void* inProcessServerArg = nullptr;
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // wait details
+
+    WaitPolicy waitPolicy = kWaitPolicySleep;
+    uint64_t spinBudget = 0;
+    int64_t turnaroundAverage = 0;
+    std::atomic<uint32_t> numSpinWaits { 0 };
+    std::atomic<uint32_t> numSleepWaits { 0 };
+    std::atomic<uint32_t> numXruns { 0 };
+    std::atomic<uint32_t> numResyncs { 0 };
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // ring details
+
+    // head: first not yet released, queued: first not yet written, tail: first not yet processed by the server,
+    // done: first not yet readable, ahead of tail when periods are late
+    bool ringEnabled = false;
+    uint32_t ringHead = 0;
+    uint32_t ringQueued = 0;
+    uint32_t ringTail = 0;
+    uint32_t ringDone = 0;
+    uint64_t lastProgressTime = 0;
+
+    // read back in place of late periods
+    const Period silentPeriod = {};
+
+    void resetRing() noexcept
+    {
+        ringEnabled = false;
+        ringHead = ringQueued = ringTail = ringDone = 0;
+    }
+
+    void setTail(const uint32_t tail) noexcept
+    {
+        if (tail == ringTail)
+            return;
+
+        ringTail = tail;
+        lastProgressTime = getMonotonicTime();
+    }
+
+    // compare free-running counters
+    static bool isBefore(const uint32_t a, const uint32_t b) noexcept
+    {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    // wait for all queued periods to be processed, and discard any left-over server post
+    void drainRing()
+    {
+        if (! ringEnabled)
+        {
+            // a late period still owes us a post
+            if (ringTail != ringQueued && wait())
+                ringTail = ringQueued;
+            return;
+        }
+
+        while (ringQueued != __atomic_load_n(&data->ring.tail, __ATOMIC_ACQUIRE))
+        {
+            if (! wait())
+                break;
+        }
+
+        tryWait();
+    }
 
     // ----------------------------------------------------------------------------------------------------------------
     // semaphore details
 
     void post()
     {
+        data->timings.pluginPost = getMonotonicTime();
+
+        if (inProcessServer != nullptr)
+        {
+            inProcessServer(inProcessServerArg);
+            return;
+        }
+
        #if defined(DISTRHO_OS_WINDOWS)
         ReleaseSemaphore(data->sem1, 1, nullptr);
        #else
@@ -267,22 +992,72 @@ private:
        #endif
     }
 
-    bool wait()
+    bool wait(const uint64_t timeoutNs = kDefaultTimeoutNs)
+    {
+        if (waitPolicy == kWaitPolicyAdaptiveSpin)
+        {
+            const uint64_t spinTime = std::min(spinBudget, timeoutNs);
+
+            if (spinWait(spinTime))
+            {
+                numSpinWaits.fetch_add(1, std::memory_order_relaxed);
+                updateSpinBudget();
+                return true;
+            }
+
+            if (! sleepWait(timeoutNs - spinTime))
+                return false;
+
+            numSleepWaits.fetch_add(1, std::memory_order_relaxed);
+            updateSpinBudget();
+            return true;
+        }
+
+        if (! sleepWait(timeoutNs))
+            return false;
+
+        numSleepWaits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool sleepWait(const uint64_t timeoutNs)
     {
       #if defined(DISTRHO_OS_WINDOWS)
-        return WaitForSingleObject(data->sem2, 1000) == WAIT_OBJECT_0;
+        const DWORD timeout = static_cast<DWORD>((timeoutNs + 999999) / 1000000);
+
+        // also wake up if the server side process dies
+        if (peerProcess != nullptr)
+        {
+            const HANDLE handles[2] = { data->sem2, peerProcess };
+            return WaitForMultipleObjects(2, handles, FALSE, timeout) == WAIT_OBJECT_0;
+        }
+
+        return WaitForSingleObject(data->sem2, timeout) == WAIT_OBJECT_0;
       #else
-       #ifdef DISTRHO_OS_MAC
-        const uint32_t timeout = 1000000;
-       #else
-        const timespec timeout = { 1, 0 };
-       #endif
+        // spurious wake-ups and signals must not extend the wait past the original timeout
+        const uint64_t deadline = getMonotonicTime() + timeoutNs;
 
         for (;;)
         {
             if (__sync_bool_compare_and_swap(&data->sem2, 1, 0))
                 return true;
 
+            const uint64_t now = getMonotonicTime();
+            if (now >= deadline)
+                return false;
+
+            const uint64_t remaining = deadline - now;
+
+           #ifdef DISTRHO_OS_MAC
+            // NOTE a timeout of 0 means forever
+            const uint32_t timeout = static_cast<uint32_t>(std::max<uint64_t>(1, remaining / 1000));
+           #else
+            const timespec timeout = {
+                static_cast<time_t>(remaining / 1000000000ULL),
+                static_cast<long>(remaining % 1000000000ULL)
+            };
+           #endif
+
            #ifdef DISTRHO_OS_MAC
             if (__ulock_wait(0x3, &data->sem2, 0, timeout) != 0)
            #else
@@ -294,6 +1069,76 @@ private:
        #endif
     }
 
+    // check for a server post without waiting
+    bool tryWait()
+    {
+       #if defined(DISTRHO_OS_WINDOWS)
+        return WaitForSingleObject(data->sem2, 0) == WAIT_OBJECT_0;
+       #else
+        return __sync_bool_compare_and_swap(&data->sem2, 1, 0);
+       #endif
+    }
+
+    // busy-wait for the server side for up to spinTime nanoseconds
+    bool spinWait(const uint64_t spinTime) noexcept
+    {
+        if (spinTime == 0)
+            return false;
+
+        const uint64_t deadline = getMonotonicTime() + spinTime;
+
+        for (uint32_t i = 1;; ++i)
+        {
+           #if defined(DISTRHO_OS_WINDOWS)
+            // semaphore state can only be polled through a syscall, do it less often
+            if ((i & 0xf) == 0 && WaitForSingleObject(data->sem2, 0) == WAIT_OBJECT_0)
+                return true;
+           #else
+            if (__atomic_load_n(&data->sem2, __ATOMIC_RELAXED) == 1 && __sync_bool_compare_and_swap(&data->sem2, 1, 0))
+                return true;
+           #endif
+
+           #if defined(__i386__) || defined(__x86_64__)
+            __builtin_ia32_pause();
+           #elif defined(__aarch64__) || defined(__arm__)
+            __asm__ __volatile__("yield");
+           #endif
+
+            if ((i & 0x3f) == 0 && getMonotonicTime() >= deadline)
+                return false;
+        }
+    }
+
+    // learn the spin budget from recent server turnaround times, capped to a fraction of the period duration
+    // a server slower than the cap disables spinning, until it becomes fast again
+    void updateSpinBudget() noexcept
+    {
+        const int64_t turnaround = static_cast<int64_t>(getMonotonicTime() - data->timings.pluginPost);
+        turnaroundAverage += (turnaround - turnaroundAverage) / 8;
+
+        const uint64_t periodTimeNs = static_cast<uint64_t>(periodSize) * 1000000000ULL / 48000;
+        const uint64_t maxSpinTime = std::min<uint64_t>(kMaxSpinTimeNs, periodTimeNs / 4);
+        const uint64_t average = static_cast<uint64_t>(std::max<int64_t>(0, turnaroundAverage));
+
+        spinBudget = average <= maxSpinTime ? std::min<uint64_t>(maxSpinTime, average + average / 4) : 0;
+    }
+
+    // client 0 keeps the original name, for compatibility with older servers
+    static void getShmName(char shmName[32], const uint portBaseNum, const uint clientNum)
+    {
+      #ifdef DISTRHO_OS_WINDOWS
+        if (clientNum == 0)
+            std::snprintf(shmName, 31, "Local\\mod-desktop-shm-%d", portBaseNum);
+        else
+            std::snprintf(shmName, 31, "Local\\mod-desktop-shm-%d-%u", portBaseNum, clientNum);
+      #else
+        if (clientNum == 0)
+            std::snprintf(shmName, 31, "/mod-desktop-shm-%d", portBaseNum);
+        else
+            std::snprintf(shmName, 31, "/mod-desktop-shm-%d-%u", portBaseNum, clientNum);
+      #endif
+    }
+
    bool fail_deinit()
    {
        deinit();
@@ -0,0 +1,115 @@
+// SPDX-FileCopyrightText: 2023-2024 MOD Audio UG
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#pragma once
+
+#include "extra/String.hpp"
+#include "extra/Time.hpp"
+
+#include <atomic>
+
+START_NAMESPACE_DISTRHO
+
+// --------------------------------------------------------------------------------------------------------------------
+// Records when each startup phase is first reached, relative to the start of the plugin instance.
+// mark() is lock-free and safe to call from the audio thread, later calls for an already reached phase are ignored.
+
+class StartupProfiler
+{
+public:
+    enum Phase {
+        kPhaseEnvironment,
+        kPhaseActivate,
+        kPhaseJackdSpawn,
+        kPhaseFirstSync,
+        kPhaseFirstAudioBlock,
+        kPhaseModUISpawn,
+        kPhaseUIReady,
+        kPhaseCount
+    };
+
+    StartupProfiler() noexcept
+    {
+        start();
+    }
+
+    // reset all phases, making the current time the origin of new ones
+    void start() noexcept
+    {
+        origin = d_gettime_us();
+
+        for (uint i = 0; i < kPhaseCount; ++i)
+            times[i].store(0, std::memory_order_relaxed);
+    }
+
+    void mark(const Phase phase) noexcept
+    {
+        if (times[phase].load(std::memory_order_relaxed) != 0)
+            return;
+
+        // offset by 1, so 0 means not reached yet
+        const uint64_t elapsed = d_gettime_us() - origin + 1;
+        uint64_t unset = 0;
+        times[phase].compare_exchange_strong(unset, elapsed, std::memory_order_relaxed);
+    }
+
+    bool hasReached(const Phase phase) const noexcept
+    {
+        return times[phase].load(std::memory_order_relaxed) != 0;
+    }
+
+    // single-line JSON object with the time in milliseconds of each reached phase
+    String toJSON() const
+    {
+        String json("{");
+
+        for (uint i = 0; i < kPhaseCount; ++i)
+        {
+            const uint64_t time = times[i].load(std::memory_order_relaxed);
+
+            if (time == 0)
+                continue;
+
+            char value[32] = {};
+            std::snprintf(value, sizeof(value) - 1, "%.3f", static_cast<double>(time - 1) * 0.001);
+
+            if (json.length() != 1)
+                json += ",";
+
+            json += "\"";
+            json += getPhaseName(static_cast<Phase>(i));
+            json += "\":";
+            json += value;
+        }
+
+        json += "}";
+        return json;
+    }
+
+    static const char* getPhaseName(const Phase phase) noexcept
+    {
+        switch (phase)
+        {
+        case kPhaseEnvironment: return "environment";
+        case kPhaseActivate: return "activate";
+        case kPhaseJackdSpawn: return "jackd-spawn";
+        case kPhaseFirstSync: return "first-sync";
+        case kPhaseFirstAudioBlock: return "first-audio-block";
+        case kPhaseModUISpawn: return "mod-ui-spawn";
+        case kPhaseUIReady: return "ui-ready";
+        case kPhaseCount: break;
+        }
+
+        return "";
+    }
+
+private:
+    uint64_t origin = 0;
+    std::atomic<uint64_t> times[kPhaseCount];
+
+    DISTRHO_DECLARE_NON_COPYABLE(StartupProfiler)
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+END_NAMESPACE_DISTRHO
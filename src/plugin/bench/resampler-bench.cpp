@@ -0,0 +1,437 @@
+// SPDX-FileCopyrightText: 2023-2024 MOD Audio UG
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+// Standalone benchmark and quality checks for the resampler code compiled into the plugin.
+// Covers the rates the plugin converts between, so kernel or buffer layout changes can be compared before and after.
+// Returns non-zero if any quality check fails.
+
+#include "../zita-resampler/resampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define HAVE_RDTSC
+#endif
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static constexpr const unsigned kEngineRate = 48000;
+static constexpr const unsigned kHostRates[] = { 44100, 88200, 96000, 192000 };
+static constexpr const unsigned kQualities[] = { 16, 32, 48, 96 };
+static constexpr const unsigned kChannels[] = { 1, 2, 4, 16 };
+static constexpr const unsigned kBlockSizes[] = { 32, 128, 512 };
+
+// how much audio to process per timed run, and how many runs to take the fastest of
+static constexpr const unsigned kPerfFrames = 1 << 15;
+static constexpr const unsigned kPerfRuns = 5;
+
+// tones are measured over this many output samples, after the filter has settled
+static constexpr const unsigned kToneFrames = 1 << 14;
+static constexpr const double kToneAmplitude = 0.5;
+
+struct Thresholds {
+    unsigned quality;
+    double minSNR;    // dB, aligned passband tone compared against the ideal one
+    double maxRipple; // dB, peak to peak gain over the passband
+    double maxAlias;  // dB below the tone, worst energy not belonging to it
+};
+
+// worst measured values across all rates with about 10dB of margin, update when the filter design changes
+// the passband edge scales with hlen, so ripple and alias rejection are about the same for all of them
+static constexpr const Thresholds kThresholds[] = {
+    { 16, 100.0, 0.02, -100.0 },
+    { 32, 115.0, 0.02, -100.0 },
+    { 48, 125.0, 0.02, -100.0 },
+    { 96, 125.0, 0.02, -100.0 },
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static uint64_t getCycles() noexcept
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double getPassbandEdge(const unsigned rateA, const unsigned rateB, const unsigned quality)
+{
+    // filter cutoff is at (1 - 2.6 / hlen) of the lower nyquist, keep clear of the transition band
+    return (1.0 - 5.2 / quality) * std::min(rateA, rateB) * 0.5;
+}
+
+// same as DesktopPlugin::primeResampler, output sample n lines up with input time n / ratio afterwards
+static void primeResampler(Resampler& resampler, const unsigned numChannels)
+{
+    const std::vector<float> silence(resampler.inpsize(), 0.f);
+    float discard = 0.f;
+
+    std::vector<const float*> inputs(numChannels, silence.data());
+    std::vector<float*> outputs(numChannels, &discard);
+
+    resampler.reset();
+    resampler.inp_count = resampler.inpsize() / 2 - 1;
+    resampler.out_count = 1;
+    resampler.inp_data = inputs.data();
+    resampler.out_data = outputs.data();
+    resampler.process();
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Quality checks, each channel gets its own tone so mixed up channels show as errors
+
+struct ToneResult {
+    double snr;      // dB, against the ideal output, only meaningful for passband tones
+    double gain;     // dB, of the fitted tone
+    double residual; // dB relative to the input amplitude, everything that is not the tone
+    double level;    // dB relative to the input amplitude, everything
+};
+
+static void resampleTones(const unsigned rateIn, const unsigned rateOut, const unsigned quality,
+                          const std::vector<double>& freqs, const unsigned blockSize,
+                          std::vector<ToneResult>& results)
+{
+    const unsigned numChannels = freqs.size();
+    const double ratio = static_cast<double>(rateOut) / rateIn;
+
+    Resampler resampler;
+    if (! resampler.setup(rateIn, rateOut, numChannels, quality))
+    {
+        std::fprintf(stderr, "resampler setup failed for %u -> %u, quality %u\n", rateIn, rateOut, quality);
+        std::exit(2);
+    }
+    primeResampler(resampler, numChannels);
+
+    // skip the filter startup, then measure
+    const unsigned skipFrames = resampler.inpsize() * std::max(1.0, ratio) * 2;
+    const unsigned numOutputFrames = skipFrames + kToneFrames;
+    const unsigned numInputFrames = (numOutputFrames + blockSize) / ratio + resampler.inpsize() + blockSize;
+
+    std::vector<std::vector<float>> inputs(numChannels, std::vector<float>(numInputFrames));
+    std::vector<std::vector<float>> outputs(numChannels, std::vector<float>(numOutputFrames + blockSize * 8));
+
+    for (unsigned c = 0; c < numChannels; ++c)
+        for (unsigned i = 0; i < numInputFrames; ++i)
+            inputs[c][i] = kToneAmplitude * std::sin(2.0 * M_PI * freqs[c] * i / rateIn);
+
+    std::vector<const float*> inputPtrs(numChannels);
+    std::vector<float*> outputPtrs(numChannels);
+    unsigned numRead = 0, numWritten = 0;
+
+    while (numWritten < numOutputFrames)
+    {
+        for (unsigned c = 0; c < numChannels; ++c)
+        {
+            inputPtrs[c] = inputs[c].data() + numRead;
+            outputPtrs[c] = outputs[c].data() + numWritten;
+        }
+
+        const unsigned outputSpace = outputs[0].size() - numWritten;
+        resampler.inp_count = blockSize;
+        resampler.out_count = outputSpace;
+        resampler.inp_data = inputPtrs.data();
+        resampler.out_data = outputPtrs.data();
+        resampler.process();
+
+        numRead += blockSize;
+        numWritten += outputSpace - resampler.out_count;
+    }
+
+    results.resize(numChannels);
+
+    for (unsigned c = 0; c < numChannels; ++c)
+    {
+        const float* const out = outputs[c].data() + skipFrames;
+        const double w = 2.0 * M_PI * freqs[c] / rateOut;
+
+        // least squares fit of the tone, windows are long enough for sin and cos to be near orthogonal
+        double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0, yy = 0.0, err = 0.0, ideal = 0.0;
+
+        for (unsigned i = 0; i < kToneFrames; ++i)
+        {
+            const double s = std::sin(w * (i + skipFrames));
+            const double k = std::cos(w * (i + skipFrames));
+            const double y = out[i];
+            const double e = y - kToneAmplitude * s;
+            ss += s * s;
+            sc += s * k;
+            cc += k * k;
+            ys += y * s;
+            yc += y * k;
+            yy += y * y;
+            err += e * e;
+            ideal += kToneAmplitude * s * kToneAmplitude * s;
+        }
+
+        const double det = ss * cc - sc * sc;
+        const double a = (ys * cc - yc * sc) / det;
+        const double b = (yc * ss - ys * sc) / det;
+
+        double res = 0.0;
+        for (unsigned i = 0; i < kToneFrames; ++i)
+        {
+            const double fit = a * std::sin(w * (i + skipFrames)) + b * std::cos(w * (i + skipFrames));
+            res += (out[i] - fit) * (out[i] - fit);
+        }
+
+        const double refPower = ideal + 1e-30;
+        ToneResult& result(results[c]);
+        result.snr = 10.0 * std::log10(refPower / (err + 1e-30));
+        result.gain = 20.0 * std::log10(std::sqrt(a * a + b * b) / kToneAmplitude + 1e-30);
+        result.residual = 10.0 * std::log10(res / refPower + 1e-30);
+        result.level = 10.0 * std::log10(yy / refPower + 1e-30);
+    }
+}
+
+static bool checkQuality(const unsigned rateIn, const unsigned rateOut, const Thresholds& thresholds)
+{
+    const unsigned quality = thresholds.quality;
+    const double edge = getPassbandEdge(rateIn, rateOut, quality);
+    std::vector<double> freqs;
+    std::vector<ToneResult> results;
+
+    // aligned tones in 1, 2 and 5 channels, covering the mono, stereo and multichannel code paths
+    double snr = 1000.0;
+    for (unsigned numChannels : { 1u, 2u, 5u })
+    {
+        freqs.clear();
+        for (unsigned c = 0; c < numChannels; ++c)
+            freqs.push_back(997.0 + 1009.0 * c);
+
+        resampleTones(rateIn, rateOut, quality, freqs, 128, results);
+
+        for (const ToneResult& result : results)
+            snr = std::min(snr, result.snr);
+    }
+
+    // passband flatness, log spaced tones from 20Hz up to the edge
+    freqs.clear();
+    for (unsigned c = 0; c < 16; ++c)
+        freqs.push_back(20.0 * std::pow(edge / 20.0, c / 15.0));
+
+    resampleTones(rateIn, rateOut, quality, freqs, 128, results);
+
+    double gainMin = 1000.0, gainMax = -1000.0, alias = -1000.0;
+    for (const ToneResult& result : results)
+    {
+        gainMin = std::min(gainMin, result.gain);
+        gainMax = std::max(gainMax, result.gain);
+        alias = std::max(alias, result.residual);
+    }
+
+    // when going down, input above the output nyquist must not fold back into the passband
+    const double stopStart = rateOut - edge;
+    const double stopEnd = rateIn * 0.5 * 0.98;
+
+    if (rateIn > rateOut && stopStart < stopEnd)
+    {
+        freqs.clear();
+        for (unsigned c = 0; c < 16; ++c)
+            freqs.push_back(stopStart + (stopEnd - stopStart) * c / 15.0);
+
+        resampleTones(rateIn, rateOut, quality, freqs, 128, results);
+
+        for (const ToneResult& result : results)
+            alias = std::max(alias, result.level);
+    }
+
+    const double ripple = gainMax - gainMin;
+    const bool ok = snr >= thresholds.minSNR && ripple <= thresholds.maxRipple && alias <= thresholds.maxAlias;
+
+    std::printf("%6u %6u %5u %8.1f %9.4f %9.1f   %s\n",
+                rateIn, rateOut, quality, snr, ripple, alias, ok ? "ok" : "FAIL");
+
+    return ok;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Performance, white noise through the same block-wise calls the plugin makes
+
+static void benchmark(const unsigned rateIn, const unsigned rateOut, const unsigned quality,
+                      const unsigned numChannels, const unsigned blockSize)
+{
+    const double ratio = static_cast<double>(rateOut) / rateIn;
+
+    Resampler resampler;
+    if (! resampler.setup(rateIn, rateOut, numChannels, quality))
+    {
+        std::fprintf(stderr, "resampler setup failed for %u -> %u, quality %u\n", rateIn, rateOut, quality);
+        std::exit(2);
+    }
+    primeResampler(resampler, numChannels);
+
+    const unsigned outputSize = blockSize * ratio + 2;
+    std::vector<std::vector<float>> inputs(numChannels, std::vector<float>(kPerfFrames));
+    std::vector<std::vector<float>> outputs(numChannels, std::vector<float>(outputSize));
+    std::vector<const float*> inputPtrs(numChannels);
+    std::vector<float*> outputPtrs(numChannels);
+
+    uint32_t seed = 0x12345678;
+    for (unsigned c = 0; c < numChannels; ++c)
+    {
+        outputPtrs[c] = outputs[c].data();
+
+        for (unsigned i = 0; i < kPerfFrames; ++i)
+        {
+            seed = seed * 1664525 + 1013904223;
+            inputs[c][i] = static_cast<int32_t>(seed) * (0.5f / 2147483648.f);
+        }
+    }
+
+    double bestTime = 1e30;
+    double bestCycles = 1e30;
+    uint64_t numOutputFrames = 0;
+
+    // first run is a warm up
+    for (unsigned run = 0; run <= kPerfRuns; ++run)
+    {
+        numOutputFrames = 0;
+
+        const uint64_t cyclesStart = getCycles();
+        const std::chrono::steady_clock::time_point timeStart = std::chrono::steady_clock::now();
+
+        for (unsigned offset = 0; offset + blockSize <= kPerfFrames; offset += blockSize)
+        {
+            for (unsigned c = 0; c < numChannels; ++c)
+                inputPtrs[c] = inputs[c].data() + offset;
+
+            resampler.inp_count = blockSize;
+            resampler.out_count = outputSize;
+            resampler.inp_data = inputPtrs.data();
+            resampler.out_data = outputPtrs.data();
+            resampler.process();
+
+            numOutputFrames += outputSize - resampler.out_count;
+        }
+
+        const std::chrono::steady_clock::time_point timeEnd = std::chrono::steady_clock::now();
+        const uint64_t cyclesEnd = getCycles();
+
+        if (run == 0)
+            continue;
+
+        bestTime = std::min(bestTime, std::chrono::duration<double, std::nano>(timeEnd - timeStart).count());
+        bestCycles = std::min(bestCycles, static_cast<double>(cyclesEnd - cyclesStart));
+    }
+
+    const double numSamples = static_cast<double>(numOutputFrames) * numChannels;
+
+#ifdef HAVE_RDTSC
+    std::printf("%6u %6u %5u %3u %6u %10.3f %10.3f\n",
+                rateIn, rateOut, quality, numChannels, blockSize, bestTime / numSamples, bestCycles / numSamples);
+#else
+    std::printf("%6u %6u %5u %3u %6u %10.3f %10s\n",
+                rateIn, rateOut, quality, numChannels, blockSize, bestTime / numSamples, "n/a");
+#endif
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+
+static void usage(const char* const argv0)
+{
+    std::printf("usage: %s [--quick] [--perf | --quality]\n"
+                "  --quick    only the default quality, stereo and 128 frame blocks for the benchmark\n"
+                "  --perf     only run the benchmark\n"
+                "  --quality  only run the quality checks\n", argv0);
+}
+
+int main(int argc, char* argv[])
+{
+    bool quick = false;
+    bool runPerf = true;
+    bool runQuality = true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else if (std::strcmp(argv[i], "--perf") == 0)
+        {
+            runQuality = false;
+        }
+        else if (std::strcmp(argv[i], "--quality") == 0)
+        {
+            runPerf = false;
+        }
+        else
+        {
+            usage(argv[0]);
+            return std::strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+
+    bool ok = true;
+
+    if (runQuality)
+    {
+        std::printf("quality: SNR against the ideal aligned tone, passband ripple, worst non-tone energy\n");
+        std::printf("  from     to  hlen   SNR dB ripple dB  alias dB\n");
+
+        for (const unsigned rate : kHostRates)
+        {
+            for (const Thresholds& thresholds : kThresholds)
+            {
+                if (quick && thresholds.quality != 32)
+                    continue;
+
+                ok &= checkQuality(rate, kEngineRate, thresholds);
+                ok &= checkQuality(kEngineRate, rate, thresholds);
+            }
+        }
+
+        std::printf("\n");
+    }
+
+    if (runPerf)
+    {
+        std::printf("performance: time per output sample and channel, best of %u runs\n", kPerfRuns);
+        std::printf("  from     to  hlen  ch  block  ns/sample cycles/sample\n");
+
+        for (const unsigned rate : kHostRates)
+        {
+            for (unsigned dir = 0; dir < 2; ++dir)
+            {
+                const unsigned rateIn = dir == 0 ? rate : kEngineRate;
+                const unsigned rateOut = dir == 0 ? kEngineRate : rate;
+
+                for (const unsigned quality : kQualities)
+                {
+                    if (quick && quality != 32)
+                        continue;
+
+                    for (const unsigned numChannels : kChannels)
+                    {
+                        if (quick && numChannels != 2)
+                            continue;
+
+                        for (const unsigned blockSize : kBlockSizes)
+                        {
+                            if (quick && blockSize != 128)
+                                continue;
+
+                            benchmark(rateIn, rateOut, quality, numChannels, blockSize);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (! ok)
+        std::printf("\nquality checks failed\n");
+
+    return ok ? 0 : 1;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
@@ -18,7 +18,14 @@ namespace std {
     using ::snwprintf;
 }
 #else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #endif
 
@@ -93,6 +100,51 @@ static const char* getDataDir()
 
 // -----------------------------------------------------------------------------------------------------------
 
+const char* getCacheDir()
+{
+   #ifdef _WIN32
+    return nullptr;
+   #else
+    static char cacheDir[PATH_MAX] = {};
+
+    if (cacheDir[0] == 0)
+    {
+        // relative paths would end up wherever the host happens to run from, no cache is better than that
+        const char* const home = getenv("HOME");
+       #ifdef __APPLE__
+        if (home == nullptr || home[0] != '/')
+            return nullptr;
+
+        std::strncpy(cacheDir, home, PATH_MAX - 1);
+        std::strncat(cacheDir, "/Library/Caches", PATH_MAX - 1);
+       #else
+        const char* const xdgCacheHome = getenv("XDG_CACHE_HOME");
+
+        if (xdgCacheHome != nullptr && xdgCacheHome[0] == '/')
+        {
+            std::strncpy(cacheDir, xdgCacheHome, PATH_MAX - 1);
+        }
+        else
+        {
+            if (home == nullptr || home[0] != '/')
+                return nullptr;
+
+            std::strncpy(cacheDir, home, PATH_MAX - 1);
+            std::strncat(cacheDir, "/.cache", PATH_MAX - 1);
+        }
+       #endif
+        mkdir(cacheDir, 0777);
+
+        std::strncat(cacheDir, "/mod-desktop", PATH_MAX - 1);
+        mkdir(cacheDir, 0777);
+    }
+
+    return cacheDir;
+   #endif
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
 #ifdef _WIN32
 static const wchar_t* getAppDirW()
 {
@@ -597,4 +649,182 @@ void openUserFilesDir()
 
 // -----------------------------------------------------------------------------------------------------------
 
+void appendStartupReport(const char* const line)
+{
+    const char* const enabled = std::getenv("MOD_DESKTOP_STARTUP_REPORT");
+
+    if (enabled == nullptr || std::strcmp(enabled, "1") != 0)
+        return;
+
+  #ifdef _WIN32
+    wchar_t path[MAX_PATH] = {};
+    std::wcsncpy(path, getDataDirW(), MAX_PATH - 1);
+    std::wcsncat(path, L"\\startup-report.jsonl", MAX_PATH - 1);
+    FILE* const f = _wfopen(path, L"a");
+  #else
+    // the data dir is based on HOME, which services and sandboxed scanners might not have
+    if (std::getenv("HOME") == nullptr)
+        return;
+
+    char path[PATH_MAX] = {};
+    std::strncpy(path, getDataDir(), PATH_MAX - 1);
+    std::strncat(path, "/startup-report.jsonl", PATH_MAX - 1);
+    FILE* const f = std::fopen(path, "a");
+  #endif
+
+    DISTRHO_SAFE_ASSERT_RETURN(f != nullptr,);
+
+    // a single write per line, so reports from concurrent instances do not interleave
+    const String data(String(line) + "\n");
+    std::fwrite(data.buffer(), data.length(), 1, f);
+    std::fclose(f);
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+static constexpr const socket_t kInvalidSocket = INVALID_SOCKET;
+#else
+typedef int socket_t;
+static constexpr const socket_t kInvalidSocket = -1;
+#endif
+
+static void closeSocket(const socket_t sock)
+{
+  #ifdef _WIN32
+    closesocket(sock);
+  #else
+    close(sock);
+  #endif
+}
+
+// connect to a local TCP port, with the given timeout applied to connecting and to replies
+static socket_t connectToLocalPort(const uint port, const uint timeoutInMilliseconds)
+{
+  #ifdef _WIN32
+    static const bool wsaInitialized = [] {
+        WSADATA wsaData;
+        return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+    }();
+    DISTRHO_SAFE_ASSERT_RETURN(wsaInitialized, kInvalidSocket);
+
+    const SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    DISTRHO_SAFE_ASSERT_RETURN(sock != INVALID_SOCKET, kInvalidSocket);
+
+    const DWORD timeout = timeoutInMilliseconds;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+  #else
+    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    DISTRHO_SAFE_ASSERT_RETURN(sock >= 0, kInvalidSocket);
+
+    timeval timeout = {};
+    timeout.tv_sec = timeoutInMilliseconds / 1000;
+    timeout.tv_usec = (timeoutInMilliseconds % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  #endif
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // connect without blocking, Windows keeps retrying a closed port for seconds otherwise
+  #ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+  #else
+    const int flags = fcntl(sock, F_GETFL);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+  #endif
+
+    bool connected = connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0;
+
+  #ifdef _WIN32
+    if (! connected && WSAGetLastError() == WSAEWOULDBLOCK)
+    {
+        fd_set wfds, efds;
+        FD_ZERO(&wfds);
+        FD_ZERO(&efds);
+        FD_SET(sock, &wfds);
+        FD_SET(sock, &efds);
+
+        timeval tv = {};
+        tv.tv_sec = timeoutInMilliseconds / 1000;
+        tv.tv_usec = (timeoutInMilliseconds % 1000) * 1000;
+
+        connected = select(0, nullptr, &wfds, &efds, &tv) > 0 && FD_ISSET(sock, &wfds);
+    }
+
+    nonBlocking = 0;
+    ioctlsocket(sock, FIONBIO, &nonBlocking);
+  #else
+    if (! connected && errno == EINPROGRESS)
+    {
+        pollfd pfd = { sock, POLLOUT, 0 };
+
+        if (poll(&pfd, 1, static_cast<int>(timeoutInMilliseconds)) > 0)
+        {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            connected = getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+        }
+    }
+
+    fcntl(sock, F_SETFL, flags);
+  #endif
+
+    if (connected)
+        return sock;
+
+    closeSocket(sock);
+    return kInvalidSocket;
+}
+
+bool sendHostCommand(const uint port, const char* const command, const uint timeoutInMilliseconds)
+{
+    const socket_t sock = connectToLocalPort(port, timeoutInMilliseconds);
+
+    if (sock == kInvalidSocket)
+        return false;
+
+    bool ok = false;
+
+    // mod-host messages are null-terminated, replies start with "resp" followed by a status code
+    if (send(sock, command, std::strlen(command) + 1, 0) > 0)
+    {
+        char reply[32] = {};
+        size_t len = 0;
+
+        while (len < sizeof(reply) - 1)
+        {
+            const int r = recv(sock, reply + len, 1, 0);
+
+            if (r <= 0 || reply[len] == '\0')
+                break;
+
+            ++len;
+        }
+
+        ok = std::strncmp(reply, "resp ", 5) == 0 && std::atoi(reply + 5) >= 0;
+    }
+
+    closeSocket(sock);
+    return ok;
+}
+
+bool isPortListening(const uint port)
+{
+    // local connections are either accepted or refused right away, only Windows makes us wait for a refusal
+    const socket_t sock = connectToLocalPort(port, 10);
+
+    if (sock == kInvalidSocket)
+        return false;
+
+    closeSocket(sock);
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------
+
 END_NAMESPACE_DISTRHO
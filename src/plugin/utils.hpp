@@ -13,6 +13,11 @@ START_NAMESPACE_DISTRHO
  */
 const char* getAppDir();
 
+/* Get the directory for caches that can be regenerated at any time, created if needed.
+ * Returns null if not available, which is the case on Windows and without an absolute HOME.
+ */
+const char* getCacheDir();
+
 /* Get environment to be used for a child process.
  */
 #ifdef _WIN32
@@ -33,6 +38,21 @@ void openWebGui(uint port);
  */
 void openUserFilesDir();
 
+/* Send a command to mod-host through its socket and wait for the reply, returns true if it succeeded.
+ * Blocks for up to the given timeout, so must not be called from the audio thread.
+ */
+bool sendHostCommand(uint port, const char* command, uint timeoutInMilliseconds = 5000);
+
+/* Check if something accepts TCP connections on a local port, without sending any data.
+ */
+bool isPortListening(uint port);
+
+/* Append a line to the startup report in the user data directory, one JSON object per startup.
+ * Shared with the systray application, which writes its own entries into the same file.
+ * Only meant for development, nothing is written unless MOD_DESKTOP_STARTUP_REPORT=1 is set in the environment.
+ */
+void appendStartupReport(const char* line);
+
 // -----------------------------------------------------------------------------------------------------------
 
 END_NAMESPACE_DISTRHO
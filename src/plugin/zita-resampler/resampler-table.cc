@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 #include "resampler-table.h"
 
 
@@ -30,6 +31,31 @@
 # define ENABLE_VEC4
 #endif
 
+#undef ENABLE_CACHE
+#ifndef _WIN32
+# define ENABLE_CACHE
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+
+// Cache files hold a header padded to 64 bytes followed by the raw table, which keeps
+// the table aligned for all kernels. Bump the magic when the table formula changes.
+
+static const char          CACHE_MAGIC [8] = { 'z', 'r', 't', 'a', 'b', '0', '1', 0 };
+static const unsigned int  CACHE_HDRSIZE = 64;
+
+struct Resampler_cache_header
+{
+    char          magic [8];
+    double        fr;
+    uint32_t      hl;
+    uint32_t      np;
+    uint32_t      fsize;
+};
+
 
 static double sinc (double x)
 {
@@ -51,6 +77,7 @@ static double wind (double x)
 
 Resampler_table  *Resampler_table::_list = 0;
 Resampler_mutex   Resampler_table::_mutex;
+char              Resampler_table::_cachedir [1024] = "";
 
 
 Resampler_table::Resampler_table (double fr, unsigned int hl, unsigned int np) :
@@ -58,15 +85,29 @@ Resampler_table::Resampler_table (double fr, unsigned int hl, unsigned int np) :
     _refc (0),
     _fr (fr),
     _hl (hl),
-    _np (np)
+    _np (np),
+    _map (0),
+    _mapsize (0)
 {
     unsigned int  i, j, n;
     double        t;
     float         *p;
+    char          path [1200];
+    uint64_t      frbits;
 
     n = hl * (np + 1);
+
+    // exact parameters in the name, so a table is never shared between similar setups
+    path [0] = 0;
+    if (_cachedir [0])
+    {
+        memcpy (&frbits, &fr, sizeof (frbits));
+        snprintf (path, sizeof (path), "%s/table-%016llx-%u-%u.bin", _cachedir, (unsigned long long) frbits, hl, np);
+        if (load_cache (path, n)) return;
+    }
+
 #ifdef ENABLE_VEC4
-    posix_memalign ((void **) &_ctab, 16, n * sizeof (float));
+    posix_memalign ((void **) &_ctab, 64, n * sizeof (float));
 #else
     _ctab = new float [n];
 #endif
@@ -81,11 +122,20 @@ Resampler_table::Resampler_table (double fr, unsigned int hl, unsigned int np) :
         }
         p += hl;
     }
+
+    if (path [0]) save_cache (path, n);
 }
 
 
 Resampler_table::~Resampler_table (void)
 {
+#ifdef ENABLE_CACHE
+    if (_map)
+    {
+        munmap (_map, _mapsize);
+        return;
+    }
+#endif
 #ifdef ENABLE_VEC4
     free (_ctab);
 #else
@@ -94,6 +144,103 @@ Resampler_table::~Resampler_table (void)
 }
 
 
+void Resampler_table::set_cache_dir (const char *path)
+{
+    _mutex.lock ();
+    _cachedir [0] = 0;
+#ifdef ENABLE_CACHE
+    if (path && (strlen (path) < sizeof (_cachedir)))
+    {
+        strcpy (_cachedir, path);
+        mkdir (_cachedir, 0755);
+    }
+#else
+    (void) path;
+#endif
+    _mutex.unlock ();
+}
+
+
+bool Resampler_table::load_cache (const char *path, unsigned int n)
+{
+#ifdef ENABLE_CACHE
+    Resampler_cache_header  H;
+    struct stat             st;
+    unsigned int            size;
+    void                    *p;
+    int                     fd;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    size = CACHE_HDRSIZE + n * sizeof (float);
+    p = MAP_FAILED;
+    if ((fstat (fd, &st) == 0) && (st.st_size == (off_t) size))
+    {
+        p = mmap (0, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close (fd);
+    if (p == MAP_FAILED) return false;
+
+    memcpy (&H, p, sizeof (H));
+    if (   memcmp (H.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC))
+        || (H.fr != _fr) || (H.hl != _hl) || (H.np != _np) || (H.fsize != sizeof (float)))
+    {
+        munmap (p, size);
+        return false;
+    }
+
+    _map = p;
+    _mapsize = size;
+    _ctab = (float *)((char *) p + CACHE_HDRSIZE);
+    return true;
+#else
+    (void) path;
+    (void) n;
+    return false;
+#endif
+}
+
+
+// Written to a temporary file first and renamed into place, so other processes
+// only ever see complete tables. Failures just mean the table is not persisted.
+
+void Resampler_table::save_cache (const char *path, unsigned int n)
+{
+#ifdef ENABLE_CACHE
+    Resampler_cache_header  H;
+    char                    hdr [CACHE_HDRSIZE];
+    char                    tmp [1300];
+    unsigned int            size;
+    bool                    ok;
+    int                     fd;
+
+    snprintf (tmp, sizeof (tmp), "%s.%d.tmp", path, (int) getpid ());
+    fd = open (tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    memset (&H, 0, sizeof (H));
+    memcpy (H.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC));
+    H.fr = _fr;
+    H.hl = _hl;
+    H.np = _np;
+    H.fsize = sizeof (float);
+    memset (hdr, 0, sizeof (hdr));
+    memcpy (hdr, &H, sizeof (H));
+
+    size = n * sizeof (float);
+    ok =   (write (fd, hdr, sizeof (hdr)) == (ssize_t) sizeof (hdr))
+        && (write (fd, _ctab, size) == (ssize_t) size);
+    ok = (close (fd) == 0) && ok;
+
+    if (!ok || rename (tmp, path)) unlink (tmp);
+#else
+    (void) path;
+    (void) n;
+#endif
+}
+
+
 Resampler_table *Resampler_table::create (double fr, unsigned int hl, unsigned int np)
 {
     Resampler_table *P;
@@ -42,11 +42,20 @@ private:
 
 class Resampler_table
 {
+public:
+
+    // Directory for persisting tables between processes, or null to disable it.
+    // Tables in there are memory-mapped read-only and so shared between processes.
+    static void set_cache_dir (const char *path);
+
 private:
 
     Resampler_table (double fr, unsigned int hl, unsigned int np);
     ~Resampler_table (void);
 
+    bool load_cache (const char *path, unsigned int n);
+    void save_cache (const char *path, unsigned int n);
+
     friend class Resampler;
     friend class VResampler;
 
@@ -56,12 +65,15 @@ private:
     double               _fr;
     unsigned int         _hl;
     unsigned int         _np;
+    void                *_map;
+    unsigned int         _mapsize;
 
     static Resampler_table *create (double fr, unsigned int hl, unsigned int np);
     static void destroy (Resampler_table *T);
 
     static Resampler_table  *_list;
     static Resampler_mutex   _mutex;
+    static char              _cachedir [1024];
 };
 
 
@@ -26,10 +26,15 @@
 #include "resampler.h"
 
 #undef ENABLE_VEC4
+#undef ENABLE_X86_DISPATCH
 #ifndef _WIN32
 # if defined(__SSE2_MATH__)
 #  define ENABLE_VEC4
 #  include <xmmintrin.h>
+#  if defined(__x86_64__) && defined(__GNUC__)
+#   define ENABLE_X86_DISPATCH
+#   include <immintrin.h>
+#  endif
 # elif defined(__ARM_NEON) || defined(__ARM_NEON__)
 #  define ENABLE_VEC4
 #  include <arm_neon.h>
@@ -60,10 +65,279 @@ static unsigned int gcd (unsigned int a, unsigned int b)
 }
 
 
+// Inner products of one output sample, q1 walks forward from the oldest input frame
+// and q2 backwards from past the newest one. hl must be a multiple of the kernel width,
+// and c1, c2 aligned to it. The dotprod2 variants take interleaved stereo frames and
+// share each coefficient load between both channels.
+
+#if defined(__SSE2_MATH__) && !defined(_WIN32)
+static float dotprod_sse (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl)
+{
+    __m128 C1, C2, Q1, Q2, S;
+    S = _mm_setzero_ps ();
+    for (unsigned int i = 0; i < hl; i += 4)
+    {
+        C1 = _mm_load_ps (c1 + i);
+        Q1 = _mm_loadu_ps (q1);
+        q2 -= 4;
+        S = _mm_add_ps (S, _mm_mul_ps (C1, Q1));
+        C2 = _mm_loadr_ps (c2 + i);
+        Q2 = _mm_loadu_ps (q2);
+        q1 += 4;
+        S = _mm_add_ps (S, _mm_mul_ps (C2, Q2));
+    }
+    return S [0] + S [1] + S [2] + S [3];
+}
+
+static void dotprod2_sse (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl, float *s)
+{
+    __m128 C1, C2, A, B, L, R;
+    L = _mm_setzero_ps ();
+    R = _mm_setzero_ps ();
+    for (unsigned int i = 0; i < hl; i += 4)
+    {
+        C1 = _mm_load_ps (c1 + i);
+        A = _mm_loadu_ps (q1);
+        B = _mm_loadu_ps (q1 + 4);
+        q1 += 8;
+        L = _mm_add_ps (L, _mm_mul_ps (C1, _mm_shuffle_ps (A, B, _MM_SHUFFLE (2, 0, 2, 0))));
+        R = _mm_add_ps (R, _mm_mul_ps (C1, _mm_shuffle_ps (A, B, _MM_SHUFFLE (3, 1, 3, 1))));
+        q2 -= 8;
+        C2 = _mm_loadr_ps (c2 + i);
+        A = _mm_loadu_ps (q2);
+        B = _mm_loadu_ps (q2 + 4);
+        L = _mm_add_ps (L, _mm_mul_ps (C2, _mm_shuffle_ps (A, B, _MM_SHUFFLE (2, 0, 2, 0))));
+        R = _mm_add_ps (R, _mm_mul_ps (C2, _mm_shuffle_ps (A, B, _MM_SHUFFLE (3, 1, 3, 1))));
+    }
+    s [0] = L [0] + L [1] + L [2] + L [3];
+    s [1] = R [0] + R [1] + R [2] + R [3];
+}
+
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(_WIN32)
+// ARM64 version by Nicolas Belin <nbelin@baylibre.com>
+static float dotprod_neon (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl)
+{
+    const float32x4_t *C1 = (const float32x4_t *)c1;
+    const float32x4_t *C2 = (const float32x4_t *)c2;
+    float32x4_t S, T;
+    q2 -= 4;
+    T = vrev64q_f32 (vld1q_f32 (q2));
+    S = vmulq_f32 (vextq_f32 (T, T, 2), C2 [0]);
+    S = vmlaq_f32 (S, vld1q_f32(q1), C1 [0]);
+    for (unsigned int i = 1; i < (hl>>2); i++)
+    {
+        q2 -= 4;
+        q1 += 4;
+        T = vrev64q_f32 (vld1q_f32 (q2));
+        S = vmlaq_f32 (S, vextq_f32 (T, T, 2), C2 [i]);
+        S = vmlaq_f32 (S, vld1q_f32 (q1), C1 [i]);
+    }
+    return S [0] + S [1] + S [2] + S [3];
+}
+
+static void dotprod2_neon (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl, float *s)
+{
+    const float32x4_t *C1 = (const float32x4_t *)c1;
+    const float32x4_t *C2 = (const float32x4_t *)c2;
+    float32x4_t L, R, T;
+    float32x4x2_t Q;
+    L = vdupq_n_f32 (0);
+    R = vdupq_n_f32 (0);
+    for (unsigned int i = 0; i < (hl>>2); i++)
+    {
+        Q = vld2q_f32 (q1);
+        q1 += 8;
+        L = vmlaq_f32 (L, Q.val [0], C1 [i]);
+        R = vmlaq_f32 (R, Q.val [1], C1 [i]);
+        q2 -= 8;
+        Q = vld2q_f32 (q2);
+        T = vrev64q_f32 (C2 [i]);
+        T = vextq_f32 (T, T, 2);
+        L = vmlaq_f32 (L, Q.val [0], T);
+        R = vmlaq_f32 (R, Q.val [1], T);
+    }
+    s [0] = L [0] + L [1] + L [2] + L [3];
+    s [1] = R [0] + R [1] + R [2] + R [3];
+}
+
+#else
+static float dotprod_scalar (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl)
+{
+    float s = 1e-30f;
+    for (unsigned int i = 0; i < hl; i++)
+    {
+        q2--;
+        s += *q1 * c1 [i] + *q2 * c2 [i];
+        q1++;
+    }
+    return s - 1e-30f;
+}
+
+static void dotprod2_scalar (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl, float *s)
+{
+    float l = 1e-30f;
+    float r = 1e-30f;
+    for (unsigned int i = 0; i < hl; i++)
+    {
+        q2 -= 2;
+        l += q1 [0] * c1 [i] + q2 [0] * c2 [i];
+        r += q1 [1] * c1 [i] + q2 [1] * c2 [i];
+        q1 += 2;
+    }
+    s [0] = l - 1e-30f;
+    s [1] = r - 1e-30f;
+}
+#endif
+
+
+// Any other channel count, in groups of up to 16 channels, which the compiler can vectorize.
+
+static void dotprod_multi (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl,
+                           unsigned int nchan, float **out, unsigned int k)
+{
+    float s [16];
+    unsigned int i, j, m, n;
+
+    for (n = 0; n < nchan; n += 16)
+    {
+        m = (nchan - n < 16) ? nchan - n : 16;
+        for (j = 0; j < m; j++) s [j] = 0;
+        for (i = 0; i < hl; i++)
+        {
+            const float *a = q1 + i * nchan + n;
+            const float *b = q2 - (i + 1) * nchan + n;
+            for (j = 0; j < m; j++) s [j] += c1 [i] * a [j] + c2 [i] * b [j];
+        }
+        for (j = 0; j < m; j++) out [n + j][k] = s [j];
+    }
+}
+
+
+#ifdef ENABLE_X86_DISPATCH
+__attribute__ ((target ("avx")))
+static inline float hsum_avx (const __m256 S)
+{
+    __m128 T = _mm_add_ps (_mm256_castps256_ps128 (S), _mm256_extractf128_ps (S, 1));
+    T = _mm_add_ps (T, _mm_movehl_ps (T, T));
+    T = _mm_add_ss (T, _mm_shuffle_ps (T, T, 1));
+    return _mm_cvtss_f32 (T);
+}
+
+
+__attribute__ ((target ("avx2,fma")))
+static float dotprod_avx2 (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl)
+{
+    const __m256i R = _mm256_setr_epi32 (7, 6, 5, 4, 3, 2, 1, 0);
+    __m256 S1 = _mm256_setzero_ps ();
+    __m256 S2 = _mm256_setzero_ps ();
+    for (unsigned int i = 0; i < hl; i += 8)
+    {
+        q2 -= 8;
+        S1 = _mm256_fmadd_ps (_mm256_load_ps (c1 + i), _mm256_loadu_ps (q1 + i), S1);
+        S2 = _mm256_fmadd_ps (_mm256_permutevar8x32_ps (_mm256_load_ps (c2 + i), R), _mm256_loadu_ps (q2), S2);
+    }
+    return hsum_avx (_mm256_add_ps (S1, S2));
+}
+
+
+// Lane order after deinterleaving 8 stereo frames within 128-bit lanes is 0 1 4 5 2 3 6 7,
+// the coefficients are permuted to match instead of the audio, as they serve both channels.
+
+__attribute__ ((target ("avx2,fma")))
+static void dotprod2_avx2 (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl, float *s)
+{
+    const __m256i P1 = _mm256_setr_epi32 (0, 1, 4, 5, 2, 3, 6, 7);
+    const __m256i P2 = _mm256_setr_epi32 (7, 6, 3, 2, 5, 4, 1, 0);
+    __m256 C1, C2, A, B;
+    __m256 L = _mm256_setzero_ps ();
+    __m256 R = _mm256_setzero_ps ();
+    for (unsigned int i = 0; i < hl; i += 8)
+    {
+        C1 = _mm256_permutevar8x32_ps (_mm256_load_ps (c1 + i), P1);
+        A = _mm256_loadu_ps (q1);
+        B = _mm256_loadu_ps (q1 + 8);
+        q1 += 16;
+        L = _mm256_fmadd_ps (C1, _mm256_shuffle_ps (A, B, _MM_SHUFFLE (2, 0, 2, 0)), L);
+        R = _mm256_fmadd_ps (C1, _mm256_shuffle_ps (A, B, _MM_SHUFFLE (3, 1, 3, 1)), R);
+        q2 -= 16;
+        C2 = _mm256_permutevar8x32_ps (_mm256_load_ps (c2 + i), P2);
+        A = _mm256_loadu_ps (q2);
+        B = _mm256_loadu_ps (q2 + 8);
+        L = _mm256_fmadd_ps (C2, _mm256_shuffle_ps (A, B, _MM_SHUFFLE (2, 0, 2, 0)), L);
+        R = _mm256_fmadd_ps (C2, _mm256_shuffle_ps (A, B, _MM_SHUFFLE (3, 1, 3, 1)), R);
+    }
+    // horizontal sums of both channels at once
+    const __m256 H = _mm256_hadd_ps (L, R);
+    __m128 T = _mm_add_ps (_mm256_castps256_ps128 (H), _mm256_extractf128_ps (H, 1));
+    T = _mm_hadd_ps (T, T);
+    s [0] = _mm_cvtss_f32 (T);
+    s [1] = _mm_cvtss_f32 (_mm_shuffle_ps (T, T, 1));
+}
+
+
+// The masked forms of permutexvar and extractf64x4 are used on purpose, the plain ones (and the 512 to 256 bit
+// cast, which is an extract in GCC) start from an undefined vector that GCC 12 reports as uninitialized at -O3.
+
+__attribute__ ((target ("avx512f")))
+static float dotprod_avx512 (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl)
+{
+    const __m512i R = _mm512_setr_epi32 (15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    __m512 C2;
+    __m512 S1 = _mm512_setzero_ps ();
+    __m512 S2 = _mm512_setzero_ps ();
+    for (unsigned int i = 0; i < hl; i += 16)
+    {
+        q2 -= 16;
+        C2 = _mm512_load_ps (c2 + i);
+        S1 = _mm512_fmadd_ps (_mm512_load_ps (c1 + i), _mm512_loadu_ps (q1 + i), S1);
+        S2 = _mm512_fmadd_ps (_mm512_mask_permutexvar_ps (C2, 0xffff, R, C2), _mm512_loadu_ps (q2), S2);
+    }
+    const __m512d S = _mm512_castps_pd (_mm512_add_ps (S1, S2));
+    const __m256d L = _mm512_mask_extractf64x4_pd (_mm256_setzero_pd (), 0xf, S, 0);
+    const __m256d H = _mm512_mask_extractf64x4_pd (_mm256_setzero_pd (), 0xf, S, 1);
+    return hsum_avx (_mm256_add_ps (_mm256_castpd_ps (L), _mm256_castpd_ps (H)));
+}
+#endif
+
+
+// Pick the widest kernel supported by the running CPU, returns hl rounded up to its width.
+// AVX-512 is only used when that needs no more rounding than AVX2, so both get the same filter.
+// Tables are always aligned to 64 bytes, which suits all of them.
+
+static unsigned int select_dotprod (unsigned int hl, Resampler::dotprod_func *func, Resampler::dotprod2_func *func2)
+{
+#ifdef ENABLE_X86_DISPATCH
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+    {
+        hl = (hl + 7) & ~7;
+        *func = ((hl & 15) == 0 && __builtin_cpu_supports ("avx512f")) ? dotprod_avx512 : dotprod_avx2;
+        *func2 = dotprod2_avx2;
+        return hl;
+    }
+#endif
+#if defined(__SSE2_MATH__) && !defined(_WIN32)
+    *func = dotprod_sse;
+    *func2 = dotprod2_sse;
+    return (hl + 3) & ~3;
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(_WIN32)
+    *func = dotprod_neon;
+    *func2 = dotprod2_neon;
+    return (hl + 3) & ~3;
+#else
+    *func = dotprod_scalar;
+    *func2 = dotprod2_scalar;
+    return hl;
+#endif
+}
+
+
 Resampler::Resampler (void) noexcept :
     _table (0),
     _nchan (0),
-    _buff  (0)
+    _buff  (0),
+    _dotprod (0),
+    _dotprod2 (0)
 {
     reset ();
 }
@@ -93,6 +367,8 @@ bool Resampler::setup (unsigned int fs_inp,
     unsigned int       np, dp, mi, hl, n;
     double             r;
     Resampler_table    *T = 0;
+    dotprod_func       F;
+    dotprod2_func      F2;
 
     if (!nchan || (hlen < 8) || (hlen > 96))
     {
@@ -118,18 +394,17 @@ bool Resampler::setup (unsigned int fs_inp,
         hl = (unsigned int)(ceil (hl / r));
         mi = (unsigned int)(ceil (mi / r));
     }
-#ifdef ENABLE_VEC4
-    hl = (hl + 3) & ~3;
-#endif
+    hl = select_dotprod (hl, &F, &F2);
     T = Resampler_table::create (frel, hl, np);
 
     clear ();
     if (T)
     {
         _table = T;
-         n = nchan * (2 * hl + mi);
+        // mirrored history, see process ()
+        n = nchan * 2 * (2 * hl + mi);
 #ifdef ENABLE_VEC4
-        posix_memalign ((void **)(&_buff), 16, n * sizeof (float));
+        posix_memalign ((void **)(&_buff), 64, n * sizeof (float));
         memset (_buff, 0, n * sizeof (float));
 #else
         _buff = new float [n];
@@ -137,6 +412,8 @@ bool Resampler::setup (unsigned int fs_inp,
         _nchan = nchan;
         _inmax = mi;
         _pstep = dp;
+        _dotprod = F;
+        _dotprod2 = F2;
         return reset ();
     }
     else return false;
@@ -156,6 +433,8 @@ void Resampler::clear (void)
     _nchan = 0;
     _inmax = 0;
     _pstep = 0;
+    _dotprod = 0;
+    _dotprod2 = 0;
     reset ();
 }
 
@@ -197,8 +476,8 @@ bool Resampler::reset (void) noexcept
 
 bool Resampler::process (void)
 {
-    unsigned int   hl, np, ph, dp, in, nr, nz, di, i, j, n, inp_i, outp_i;
-    float          *c1, *c2, *p1, *p2, *q1, *q2;
+    unsigned int   hl, np, ph, dp, in, nr, nz, nc, bl, wp, j, inp_i, outp_i;
+    float          *c1, *c2, *p1, *p2, *q, s [2];
 
     if (!_table) return false;
     hl = _table->_hl;
@@ -208,19 +487,24 @@ bool Resampler::process (void)
     nr = _nread;
     nz = _nzero;
     ph = _phase;
-
-    p1 = _buff + in;
-    p2 = p1 + 2 * hl - nr;
-    di = 2 * hl + _inmax;
+    nc = _nchan;
+
+    // The history is a ring of bl interleaved frames, with each frame written twice, bl frames
+    // apart. Any 2 * hl frames starting in the first half are then contiguous, so the ring never
+    // needs to be moved. in is where the current input window starts, wp the next frame to write.
+    bl = 2 * hl + _inmax;
+    wp = in + 2 * hl - nr;
+    if (wp >= bl) wp -= bl;
     inp_i = outp_i = 0;
 
     while (out_count)
     {
         while (nr && inp_count)
         {
-            for (j = 0; j < _nchan; j++) p2 [j * di] = inp_data[j][inp_i];
+            q = _buff + wp * nc;
+            for (j = 0; j < nc; j++) q [j] = q [j + bl * nc] = inp_data[j][inp_i];
+            if (++wp == bl) wp = 0;
             nz = 0;
-            ++p2;
             --nr;
             --inp_count;
             ++inp_i;
@@ -231,71 +515,27 @@ bool Resampler::process (void)
         {
             c1 = _table->_ctab + hl * ph;
             c2 = _table->_ctab + hl * (np - ph);
+            p1 = _buff + in * nc;
+            p2 = p1 + 2 * hl * nc;
 
-#if defined(__SSE2_MATH__) && !defined(_WIN32)
-            __m128 C1, C2, Q1, Q2, S;
-            for (j = 0; j < _nchan; j++)
+            if (nc == 1)
             {
-                q1 = p1 + j * di;
-                q2 = p2 + j * di;
-                S = _mm_setzero_ps ();
-                for (i = 0; i < hl; i += 4)
-                {
-                    C1 = _mm_load_ps (c1 + i);
-                    Q1 = _mm_loadu_ps (q1);
-                    q2 -= 4;
-                    S = _mm_add_ps (S, _mm_mul_ps (C1, Q1));
-                    C2 = _mm_loadr_ps (c2 + i);
-                    Q2 = _mm_loadu_ps (q2);
-                    q1 += 4;
-                    S = _mm_add_ps (S, _mm_mul_ps (C2, Q2));
-                }
-                out_data[j][outp_i] = S [0] + S [1] + S [2] + S [3];
+                out_data[0][outp_i] = _dotprod (c1, c2, p1, p2, hl);
             }
-
-#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(_WIN32)
-            // ARM64 version by Nicolas Belin <nbelin@baylibre.com>
-            float32x4_t *C1 = (float32x4_t *)c1;
-            float32x4_t *C2 = (float32x4_t *)c2;
-            float32x4_t S, T;
-            for (j = 0; j < _nchan; j++)
+            else if (nc == 2)
             {
-                q1 = p1 + j * di;
-                q2 = p2 + j * di - 4;
-                T = vrev64q_f32 (vld1q_f32 (q2));
-                S = vmulq_f32 (vextq_f32 (T, T, 2), C2 [0]);
-                S = vmlaq_f32 (S, vld1q_f32(q1), C1 [0]);
-                for (i = 1; i < (hl>>2); i++)
-                {
-                    q2 -= 4;
-                    q1 += 4;
-                    T = vrev64q_f32 (vld1q_f32 (q2));
-                    S = vmlaq_f32 (S, vextq_f32 (T, T, 2), C2 [i]);
-                    S = vmlaq_f32 (S, vld1q_f32 (q1), C1 [i]);
-                }
-                out_data[j][outp_i] = S [0] + S [1] + S [2] + S [3];
+                _dotprod2 (c1, c2, p1, p2, hl, s);
+                out_data[0][outp_i] = s [0];
+                out_data[1][outp_i] = s [1];
             }
-
-#else
-            float s;
-            for (j = 0; j < _nchan; j++)
+            else
             {
-                q1 = p1 + j * di;
-                q2 = p2 + j * di;
-                s = 1e-30f;
-                for (i = 0; i < hl; i++)
-                {
-                    q2--;
-                    s += *q1 * c1 [i] + *q2 * c2 [i];
-                    q1++;
-                }
-                out_data[j][outp_i] = s - 1e-30f;
+                dotprod_multi (c1, c2, p1, p2, hl, nc, out_data, outp_i);
             }
-#endif
         }
         else
         {
-            for (j = 0; j < _nchan; j++) out_data[j][outp_i] = 0;
+            for (j = 0; j < nc; j++) out_data[j][outp_i] = 0;
         }
         --out_count;
         ++outp_i;
@@ -306,19 +546,7 @@ bool Resampler::process (void)
             nr = ph / np;
             ph -= nr * np;
             in += nr;
-            p1 += nr;
-            if (in >= _inmax)
-            {
-                n = 2 * hl - nr;
-                p2 = _buff;
-                for (j = 0; j < _nchan; j++)
-                {
-                    memmove (p2 + j * di, p1 + j * di, n * sizeof (float));
-                }
-                in = 0;
-                p1 = _buff;
-                p2 = p1 + n;
-            }
+            if (in >= bl) in -= bl;
         }
     }
 
@@ -330,4 +558,3 @@ bool Resampler::process (void)
     return true;
 }
 
-
@@ -29,6 +29,9 @@ class Resampler
 {
 public:
 
+    typedef float (*dotprod_func) (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl);
+    typedef void (*dotprod2_func) (const float *c1, const float *c2, const float *q1, const float *q2, unsigned int hl, float *s);
+
     Resampler (void) noexcept;
     ~Resampler (void);
 
@@ -67,6 +70,8 @@ private:
     unsigned int         _phase;
     unsigned int         _pstep;
     float               *_buff;
+    dotprod_func         _dotprod;
+    dotprod2_func        _dotprod2;
     void                *_dummy [8];
 };
 
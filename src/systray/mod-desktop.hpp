@@ -7,6 +7,8 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonObject>
 #include <QtCore/QProcess>
 #include <QtCore/QSettings>
 #include <QtCore/QTimer>
@@ -26,6 +28,7 @@
 #endif
 
 #ifdef Q_OS_WIN
+#include <winsock2.h>
 #include <windows.h>
 #else
 #include <cstring>
@@ -128,6 +131,11 @@ class AppWindow : public QMainWindow
     bool successfullyStarted = false;
     int timerId = 0;
 
+    // startup phase times since pressing start, see markStartupPhase()
+    QElapsedTimer startupTimer;
+    QJsonObject startupPhases;
+    QTimer uiReadyTimer;
+
    #ifdef Q_OS_WIN
     HANDLE openEvent = nullptr;
    #endif
@@ -223,6 +231,9 @@ public:
         connect(&processUI, qOverload<int, QProcess::ExitStatus>(&QProcess::finished), this, &AppWindow::uiFinished);
         connect(&processUI, &QProcess::readyReadStandardOutput, this, &AppWindow::uiReadStdOut);
 
+        uiReadyTimer.setInterval(20);
+        connect(&uiReadyTimer, &QTimer::timeout, this, &AppWindow::uiCheckReady);
+
         timerId = startTimer(500);
 
        #ifdef Q_OS_WIN
@@ -791,6 +802,31 @@ private:
         systray->setToolTip(tr("MOD Desktop: Stopped"));
     }
 
+    // record the first time a startup phase is reached, in milliseconds since pressing start
+    void markStartupPhase(const char* const name)
+    {
+        if (startupTimer.isValid() && ! startupPhases.contains(name))
+            startupPhases[name] = startupTimer.nsecsElapsed() / 1000000.0;
+    }
+
+    // write the recorded startup phases to the startup report, once per start
+    void reportStartup(const bool complete)
+    {
+        if (! startupTimer.isValid())
+            return;
+
+        startupTimer.invalidate();
+        uiReadyTimer.stop();
+
+        QJsonObject report;
+        report["component"] = "systray";
+        report["version"] = VERSION;
+        report["complete"] = complete;
+        report["bufferSize"] = ui.cb_buffersize->currentText().toInt();
+        report["phases"] = startupPhases;
+        appendStartupReport(report);
+    }
+
     QString getProcessErrorAsString(QProcess::ProcessError error)
     {
         printf("----------- %s %d\n", __FUNCTION__, __LINE__);
@@ -878,6 +914,9 @@ private slots:
         ui.text_host->clear();
         ui.text_ui->clear();
 
+        startupTimer.start();
+        startupPhases = QJsonObject();
+
         writeMidiChannelsToProfile(ui.sp_midi_pb->value(), ui.sp_midi_ss->value());
 
         const bool midiEnabled = ui.cb_midi->isChecked();
@@ -980,6 +1019,8 @@ private slots:
             processHost.setProcessEnvironment(env);
         }
 
+        markStartupPhase("environment");
+
         ui.text_host->appendPlainText("Starting jackd using:");
         ui.text_host->appendPlainText(arguments.join(" "));
 
@@ -1085,6 +1126,7 @@ private slots:
     void hostStartSuccess()
     {
         printf("----------- %s %d\n", __FUNCTION__, __LINE__);
+        markStartupPhase("jackd-spawn");
     }
 
     void uiStartSuccess()
@@ -1092,11 +1134,26 @@ private slots:
         printf("----------- %s %d\n", __FUNCTION__, __LINE__);
         startingUI = false;
         setRunning();
+
+        // mod-ui takes a while to import and bind its web server, the process being started is not enough
+        markStartupPhase("mod-ui-spawn");
+        uiReadyTimer.start();
+    }
+
+    void uiCheckReady()
+    {
+        if (! isWebGuiListening())
+            return;
+
+        uiReadyTimer.stop();
+        markStartupPhase("ui-ready");
+        reportStartup(true);
     }
 
     void hostFinished(int exitCode, QProcess::ExitStatus exitStatus)
     {
         printf("----------- %s %d\n", __FUNCTION__, __LINE__);
+        reportStartup(false);
         startingHost = stoppingHost = false;
         stopUIIfNeeded();
         setStopped();
@@ -1104,6 +1161,7 @@ private slots:
 
     void uiFinished(int exitCode, QProcess::ExitStatus exitStatus)
     {
+        reportStartup(false);
         startingUI = stoppingUI = false;
         stopHostIfNeeded();
         setStopped();
@@ -1120,6 +1178,7 @@ private slots:
 
         if (text.contains("Internal client mod-host successfully loaded"))
         {
+            markStartupPhase("host-ready");
             startingHost = false;
             startingUI = true;
 
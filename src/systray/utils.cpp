@@ -13,15 +13,22 @@
 #include <QtWidgets/QStyleFactory>
 
 #ifdef _WIN32
+#include <winsock2.h>
 #include <dwmapi.h>
 #include <shlobj.h>
 #define PRE_20H1_DWMWA_USE_IMMERSIVE_DARK_MODE 19
 #define DWMWA_USE_IMMERSIVE_DARK_MODE 20
 #else
 #include <QtCore/QStandardPaths>
+#include <arpa/inet.h>
+#include <cerrno>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <pwd.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #endif
@@ -393,6 +400,113 @@ void openWebGui()
     QDesktopServices::openUrl(QUrl("http://127.0.0.1:18181"));
 }
 
+#ifdef _WIN32
+typedef SOCKET socket_t;
+static constexpr const socket_t kInvalidSocket = INVALID_SOCKET;
+#else
+typedef int socket_t;
+static constexpr const socket_t kInvalidSocket = -1;
+#endif
+
+static void closeSocket(const socket_t sock)
+{
+   #ifdef _WIN32
+    closesocket(sock);
+   #else
+    close(sock);
+   #endif
+}
+
+// connection attempt started by a previous call, checked again on the next one
+static socket_t webGuiProbeSocket = kInvalidSocket;
+
+bool isWebGuiListening()
+{
+    if (webGuiProbeSocket == kInvalidSocket)
+    {
+       #ifdef _WIN32
+        static const bool wsaInitialized = [] {
+            WSADATA wsaData;
+            return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+        }();
+
+        if (! wsaInitialized)
+            return false;
+
+        const SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+        if (sock == INVALID_SOCKET)
+            return false;
+
+        u_long nonBlocking = 1;
+        ioctlsocket(sock, FIONBIO, &nonBlocking);
+       #else
+        const int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (sock < 0)
+            return false;
+
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+       #endif
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(18181);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (::connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0)
+        {
+            closeSocket(sock);
+            return true;
+        }
+
+       #ifdef _WIN32
+        const bool inProgress = WSAGetLastError() == WSAEWOULDBLOCK;
+       #else
+        const bool inProgress = errno == EINPROGRESS;
+       #endif
+
+        if (! inProgress)
+        {
+            closeSocket(sock);
+            return false;
+        }
+
+        webGuiProbeSocket = sock;
+        return false;
+    }
+
+    // only look at the pending attempt, never wait for it, as this runs on the GUI thread
+    bool done, connected;
+
+   #ifdef _WIN32
+    fd_set wfds, efds;
+    FD_ZERO(&wfds);
+    FD_ZERO(&efds);
+    FD_SET(webGuiProbeSocket, &wfds);
+    FD_SET(webGuiProbeSocket, &efds);
+
+    timeval tv = {};
+    done = select(0, nullptr, &wfds, &efds, &tv) != 0;
+    connected = done && FD_ISSET(webGuiProbeSocket, &wfds);
+   #else
+    pollfd pfd = { webGuiProbeSocket, POLLOUT, 0 };
+    done = poll(&pfd, 1, 0) != 0;
+
+    int error = -1;
+    socklen_t len = sizeof(error);
+    connected = done && getsockopt(webGuiProbeSocket, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+   #endif
+
+    if (! done)
+        return false;
+
+    // refused attempts are started again on the next call
+    closeSocket(webGuiProbeSocket);
+    webGuiProbeSocket = kInvalidSocket;
+    return connected;
+}
+
 void openUserFilesDir()
 {
    #ifdef _WIN32
@@ -574,3 +688,34 @@ void writeMidiChannelsToProfile(int pedalboard, int snapshot)
     jsonFile.seek(0);
     jsonFile.write(QJsonDocument(jsonObj).toJson());
 }
+
+void appendStartupReport(const QJsonObject& report)
+{
+    if (qgetenv("MOD_DESKTOP_STARTUP_REPORT") != "1")
+        return;
+
+    // without a data dir the report would end up in the current directory or the drive root
+   #ifdef _WIN32
+    WCHAR path[MAX_PATH] = {};
+    if (GetEnvironmentVariableW(L"MOD_DATA_DIR", path, MAX_PATH) == 0)
+        return;
+    std::wcsncat(path, L"\\startup-report.jsonl", MAX_PATH - 1);
+    const QString reportPath(QString::fromWCharArray(path));
+   #else
+    const char* const dataDir = std::getenv("MOD_DATA_DIR");
+    if (dataDir == nullptr || dataDir[0] == '\0')
+        return;
+
+    char path[PATH_MAX] = {};
+    std::strncpy(path, dataDir, PATH_MAX - 1);
+    std::strncat(path, "/startup-report.jsonl", PATH_MAX - 1);
+    const QString reportPath(QString::fromUtf8(path));
+   #endif
+
+    QFile reportFile(reportPath);
+
+    if (! reportFile.open(QIODevice::WriteOnly|QIODevice::Append|QIODevice::Text))
+        return;
+
+    reportFile.write(QJsonDocument(report).toJson(QJsonDocument::Compact) + "\n");
+}
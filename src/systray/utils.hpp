@@ -5,6 +5,7 @@
 
 #include <QtWidgets/QWidget>
 
+class QJsonObject;
 class QMainWindow;
 
 static inline
@@ -29,6 +30,11 @@ QString getLV2Path(bool includeSystemPlugins);
  */
 void openWebGui();
 
+/* Check if mod-ui accepts connections on its web server port, without blocking.
+ * A connection attempt is started on one call and checked on the next ones, so this is meant to be polled.
+ */
+bool isWebGuiListening();
+
 /* Open the "user files" directory in a file manager/explorer.
  */
 void openUserFilesDir();
@@ -55,3 +61,9 @@ void setupDarkModeWindow(QMainWindow& window);
  * This is meant to be used before starting mod-ui, so it then reads from these settings.
  */
 void writeMidiChannelsToProfile(int pedalboard, int snapshot);
+
+/* Append a startup phase report to the user data directory, one JSON object per line.
+ * Shared with the plugin, which writes its own entries into the same file.
+ * Only meant for development, nothing is written unless MOD_DESKTOP_STARTUP_REPORT=1 is set in the environment.
+ */
+void appendStartupReport(const QJsonObject& report);